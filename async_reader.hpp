@@ -0,0 +1,139 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "error.h"
+#include "uring.hpp"
+
+using ReadCallback = std::function<void(Status, std::string)>;
+
+// 异步随机读：调用者把读请求挂到队列上立即返回，后台线程把一批请求填进 io_uring，
+// 一次 io_uring_enter 提交，完成后在后台线程里回调。没有 io_uring 时逐个 pread。
+class AsyncReader
+{
+private:
+    struct Request
+    {
+        int fd;
+        uint64_t offset;
+        std::string value;
+        ReadCallback callback;
+    };
+
+    std::unique_ptr<IoUring> ring;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<Request *> pending;
+    bool stop = false;
+
+    static void finish(Request *request, ssize_t res)
+    {
+        if (res == (ssize_t)request->value.size())
+            request->callback(Status(OK, ""), std::move(request->value));
+        else
+            request->callback(Status(IoError, std::string("async read failed .") + (res < 0 ? strerror(-res) : "short read")), "");
+        delete request;
+    }
+
+    static void read_sync(Request *request)
+    {
+        ssize_t res = ::pread(request->fd, request->value.data(), request->value.size(), request->offset);
+        finish(request, res < 0 ? -errno : res);
+    }
+
+    void loop()
+    {
+        size_t inflight = 0;
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            if (!inflight)
+                cv.wait(lock, [this]
+                        { return stop || !pending.empty(); });
+            if (stop && pending.empty() && !inflight)
+                break;
+
+            std::deque<Request *> batch;
+            size_t room = ring ? ring->depth() - inflight : pending.size();
+            while (!pending.empty() && batch.size() < room)
+            {
+                batch.push_back(pending.front());
+                pending.pop_front();
+            }
+            lock.unlock();
+
+            if (!ring)
+            {
+                for (auto request : batch)
+                    read_sync(request);
+            }
+            else
+            {
+                for (auto request : batch)
+                {
+                    io_uring_sqe *sqe = ring->get_sqe();
+                    IoUring::prep_rw(sqe, IORING_OP_READ, request->fd, request->value.data(),
+                                     request->value.size(), request->offset, (uint64_t)request);
+                    inflight++;
+                }
+
+                // 提交这一批并至少等一个完成，然后把已经完成的全部收掉
+                if (ring->submit(inflight ? 1 : 0) < 0)
+                    std::cout << "async reader io_uring_enter failed : " << strerror(errno) << std::endl;
+                while (io_uring_cqe *cqe = ring->peek())
+                {
+                    Request *request = (Request *)cqe->user_data;
+                    int res = cqe->res;
+                    ring->seen();
+                    inflight--;
+
+                    if (res == -EINVAL || res == -EOPNOTSUPP) // 老内核没有 IORING_OP_READ
+                        read_sync(request);
+                    else
+                        finish(request, res);
+                }
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    AsyncReader(unsigned depth, bool use_uring)
+    {
+        if (use_uring)
+        {
+            ring.reset(new IoUring(depth));
+            if (!ring->ok())
+                ring.reset();
+        }
+        worker = std::thread(&AsyncReader::loop, this);
+    }
+
+    ~AsyncReader()
+    {
+        {
+            std::lock_guard lock(mutex);
+            stop = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+    bool uses_uring() const { return ring != nullptr; }
+
+    void submit(int fd, uint64_t offset, uint32_t len, ReadCallback callback)
+    {
+        Request *request = new Request{fd, offset, std::string(len, '\0'), std::move(callback)};
+        {
+            std::lock_guard lock(mutex);
+            pending.push_back(request);
+        }
+        cv.notify_one();
+    }
+};
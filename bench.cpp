@@ -0,0 +1,849 @@
+#include "bitcask.hpp"
+#include "crc32.h"
+#include "sharded.hpp"
+#include <fcntl.h>
+#include <malloc.h>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+
+using namespace std;
+
+// 当前进程堆上实际占用的字节数（包括 mmap 出来的大块）
+static size_t heap_used()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static string make_key(size_t i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user:%012zu", i);
+    return string(buf);
+}
+
+// 原来的 std::map<std::string, ValueIndex>，ValueIndex 里带一个文件名 string
+struct LegacyValueIndex
+{
+    std::string filename;
+    uint64_t offset, len;
+};
+
+void bench_keydir(size_t n)
+{
+    vector<string> keys;
+    for (size_t i = 0; i < n; i++)
+        keys.push_back(make_key(i));
+
+    vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    shuffle(order.begin(), order.end(), mt19937_64(42));
+
+    {
+        size_t before = heap_used();
+        auto *index = new map<string, LegacyValueIndex>;
+        for (size_t i = 0; i < n; i++)
+            (*index)[keys[i]] = LegacyValueIndex{to_string(i % 1000) + ".log", i * 64, 64};
+        size_t bytes = heap_used() - before;
+
+        uint64_t sum = 0;
+        auto t1 = chrono::high_resolution_clock::now();
+        for (auto i : order)
+            sum += index->find(keys[i])->second.offset;
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double, nano> ns = t2 - t1;
+
+        cout << "std::map   bytes/key: " << (double)bytes / n
+             << "  lookup: " << ns.count() / n << " ns  (" << sum % 10 << ")" << endl;
+        delete index;
+    }
+
+    {
+        size_t before = heap_used();
+        auto *index = new KeyDir;
+        for (size_t i = 0; i < n; i++)
+            index->put(keys[i], ValueIndex(i % 1000, i * 64, 64));
+        size_t bytes = heap_used() - before;
+
+        uint64_t sum = 0;
+        ValueIndex found;
+        auto t1 = chrono::high_resolution_clock::now();
+        for (auto i : order)
+        {
+            index->find(keys[i], &found);
+            sum += found.offset;
+        }
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double, nano> ns = t2 - t1;
+
+        cout << "KeyDir     bytes/key: " << (double)bytes / n
+             << "  lookup: " << ns.count() / n << " ns  (" << sum % 10 << ")" << endl;
+        delete index;
+    }
+}
+
+// 基准测试用的配置：大文件、不触发合并，结果不被文件切换和 compaction 干扰
+static Options bench_options(const std::string &name)
+{
+    Options options;
+    options.path = "bench_data/" + name + "/";
+    options.max_log_size = 64 << 20;
+    options.compact_threshold = UINT64_MAX;
+    fs::remove_all(options.path);
+    return options;
+}
+
+// T 个线程并发写入，分区数为 1（单锁）和 T 时各跑一遍
+void bench_sharded(size_t n)
+{
+    string value(100, 'x');
+    size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        for (size_t shards : {(size_t)1, threads})
+        {
+            Options options = bench_options("sharded");
+            options.shards = shards;
+            double ops;
+            {
+                ShardedBitcask db(options);
+                size_t per_thread = n / threads;
+
+                auto t1 = chrono::high_resolution_clock::now();
+                vector<thread> workers;
+                for (size_t t = 0; t < threads; t++)
+                    workers.emplace_back([&, t]
+                                         {
+                                             for (size_t i = 0; i < per_thread; i++)
+                                                 db.set(make_key(t * per_thread + i), value); });
+                for (auto &worker : workers)
+                    worker.join();
+                auto t2 = chrono::high_resolution_clock::now();
+
+                chrono::duration<double> sec = t2 - t1;
+                ops = per_thread * threads / sec.count();
+            }
+            cout << "threads: " << threads << "  shards: " << shards
+                 << "  set/s: " << (size_t)ops << endl;
+            if (threads == 1)
+                break;
+        }
+    }
+    fs::remove_all("bench_data/sharded/");
+}
+
+// 95% get / 5% set 的读多写少负载，读者数从 1 加到 N
+void bench_readheavy(size_t n)
+{
+    string value(100, 'x');
+    size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+
+    Options options = bench_options("readheavy");
+    options.sync_mode = kSyncNone;
+    Bitcask db(options);
+    for (size_t i = 0; i < n; i++)
+        db.set(make_key(i), value);
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        size_t per_thread = n / threads;
+
+        auto t1 = chrono::high_resolution_clock::now();
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; t++)
+            workers.emplace_back([&, t]
+                                 {
+                                     mt19937_64 rng(t);
+                                     string got;
+                                     for (size_t i = 0; i < per_thread; i++)
+                                     {
+                                         string key = make_key(rng() % n);
+                                         if (rng() % 100 < 5)
+                                             db.set(key, value);
+                                         else
+                                             db.get(key, &got);
+                                     } });
+        for (auto &worker : workers)
+            worker.join();
+        auto t2 = chrono::high_resolution_clock::now();
+
+        chrono::duration<double> sec = t2 - t1;
+        cout << "threads: " << threads << "  ops/s: " << (size_t)(per_thread * threads / sec.count()) << endl;
+    }
+    fs::remove_all(options.path);
+}
+
+// 小 value 的随机读：pread、mmap 拷贝和 mmap 零拷贝三种方式
+void bench_mmap(size_t n)
+{
+    string value(32, 'x');
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        Options options = bench_options("mmap");
+        options.max_log_size = 4 << 20;
+        options.sync_mode = kSyncNone;
+        options.mmap_sealed = mode != 0;
+
+        Bitcask db(options);
+        for (size_t i = 0; i < n; i++)
+            db.set(make_key(i), value);
+
+        mt19937_64 rng(1);
+        vector<string> keys;
+        for (size_t i = 0; i < n; i++)
+            keys.push_back(make_key(rng() % n));
+
+        size_t bytes = 0;
+        auto t1 = chrono::high_resolution_clock::now();
+        if (mode == 2)
+        {
+            Slice got;
+            for (auto &key : keys)
+            {
+                db.get(key, &got);
+                bytes += got.size();
+            }
+        }
+        else
+        {
+            string got;
+            for (auto &key : keys)
+            {
+                db.get(key, &got);
+                bytes += got.size();
+            }
+        }
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double, nano> ns = t2 - t1;
+
+        const char *names[] = {"pread      ", "mmap copy  ", "mmap slice "};
+        cout << names[mode] << " get: " << ns.count() / n << " ns  (" << bytes / n << " B)" << endl;
+    }
+    fs::remove_all("bench_data/mmap/");
+}
+
+// 把数据文件从 page cache 里踢掉，让读真正落到磁盘上
+static void drop_cache(const std::string &dir)
+{
+    for (const auto &entry : fs::directory_iterator(dir))
+    {
+        int fd = open(entry.path().c_str(), O_RDONLY);
+        if (fd < 0)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// get_async 在队列深度 1..64 下的随机读吞吐，对照同步 get
+void bench_uring(size_t n)
+{
+    string value(4096, 'x');
+
+    Options options = bench_options("uring");
+    options.sync_mode = kSyncNone;
+    options.mmap_sealed = false;
+    Bitcask db(options);
+    for (size_t i = 0; i < n; i++)
+        db.set(make_key(i), value);
+
+    mt19937_64 rng(7);
+    vector<string> keys;
+    for (size_t i = 0; i < n; i++)
+        keys.push_back(make_key(rng() % n));
+
+    {
+        drop_cache(options.path);
+        string got;
+        auto t1 = chrono::high_resolution_clock::now();
+        for (auto &key : keys)
+            db.get(key, &got);
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double> sec = t2 - t1;
+        cout << "sync get     get/s: " << (size_t)(n / sec.count()) << endl;
+    }
+
+    for (size_t depth = 1; depth <= 64; depth *= 2)
+    {
+        drop_cache(options.path);
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t inflight = 0, failed = 0;
+
+        auto t1 = chrono::high_resolution_clock::now();
+        for (auto &key : keys)
+        {
+            {
+                std::unique_lock lock(mutex);
+                cv.wait(lock, [&]
+                        { return inflight < depth; });
+                inflight++;
+            }
+            db.get_async(key, [&](Status status, std::string)
+                         {
+                             std::lock_guard lock(mutex);
+                             failed += status.code != OK;
+                             inflight--;
+                             cv.notify_all(); });
+        }
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [&]
+                    { return inflight == 0; });
+        }
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double> sec = t2 - t1;
+        cout << "queue depth " << depth << "  get/s: " << (size_t)(n / sec.count())
+             << (failed ? "  failed: " + to_string(failed) : "") << endl;
+    }
+    fs::remove_all(options.path);
+}
+
+// 写出 n 个 key、分散在很多数据文件里，然后用不同线程数重新打开，分别测读 hint 和全量扫描
+void bench_recovery(size_t n)
+{
+    string value(100, 'x');
+    Options options = bench_options("recovery");
+    options.sync_mode = kSyncNone;
+    options.max_log_size = 4 << 20;
+    {
+        Bitcask db(options);
+        for (size_t i = 0; i < n; i++)
+            db.set(make_key(i), value);
+    }
+
+    size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+    for (int use_hint = 1; use_hint >= 0; use_hint--)
+    {
+        for (size_t threads = 1; threads <= max_threads; threads *= 2)
+        {
+            if (!use_hint)
+            {
+                for (const auto &entry : fs::directory_iterator(options.path))
+                {
+                    if (entry.path().extension() == kHintSuffix)
+                        fs::remove(entry.path());
+                }
+            }
+
+            options.recovery_threads = threads;
+            auto t1 = chrono::high_resolution_clock::now();
+            Bitcask db(options);
+            auto t2 = chrono::high_resolution_clock::now();
+            chrono::duration<double, milli> ms = t2 - t1;
+            cout << (use_hint ? "hint " : "scan ") << " threads: " << threads
+                 << "  recovery: " << ms.count() << " ms" << endl;
+        }
+    }
+    fs::remove_all(options.path);
+}
+
+// 按原来 Record 构造函数的方式逐字段算 CRC_32（crc32.h 不带表的逐位实现）
+static uint32_t legacy_record_crc(uint64_t tstamp, const string &key, const string &value, InfoType type)
+{
+    uint64_t key_size = key.size(), value_size = value.size();
+    uint32_t crc = CRC::Calculate(&tstamp, kTimeStampSize, CRC::CRC_32());
+    crc = CRC::Calculate(&key_size, kKeyLenSize, CRC::CRC_32(), crc);
+    crc = CRC::Calculate(&value_size, kValueLenSize, CRC::CRC_32(), crc);
+    crc = CRC::Calculate(key.c_str(), key_size, CRC::CRC_32(), crc);
+    crc = CRC::Calculate(value.c_str(), value_size, CRC::CRC_32(), crc);
+    crc = CRC::Calculate(&type, kValueTypeSize, CRC::CRC_32(), crc);
+    return crc;
+}
+
+void bench_crc()
+{
+    const size_t total = 64 << 20;
+    string key = make_key(42);
+    cout << "crc32c hardware: " << (crc32c_hardware() ? "sse4.2" : "none") << endl;
+
+    for (size_t size : {64, 1024, 64 << 10, 1 << 20})
+    {
+        string value(size, 'x');
+        for (size_t i = 0; i < size; i++)
+            value[i] = (char)(i * 131);
+        size_t rounds = total / size;
+        uint32_t sink = 0;
+
+        auto run = [&](const char *name, auto &&fn)
+        {
+            auto t1 = chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < rounds; i++)
+                sink ^= fn(i);
+            auto t2 = chrono::high_resolution_clock::now();
+            chrono::duration<double> s = t2 - t1;
+            cout << "  " << name << ": " << (double)rounds * size / (1 << 20) / s.count() << " MB/s" << endl;
+        };
+
+        cout << "value size: " << size << endl;
+        run("record CRC_32 bitwise (old)", [&](size_t i)
+            { return legacy_record_crc(i, key, value, kNewValue); });
+        static const CRC::Table<crcpp_uint32, 32> table(CRC::CRC_32());
+        run("CRC_32 with CRC::Table     ", [&](size_t)
+            { return CRC::Calculate(value.data(), size, table); });
+        run("crc32c slicing-by-8        ", [&](size_t)
+            { return crc32c_portable(0, value.data(), size); });
+        run("crc32c dispatched          ", [&](size_t)
+            { return crc32c(value.data(), size); });
+
+        unique_ptr<char[]> buffer(new char[record_size(key.size(), size)]);
+        run("Record::build_buffer (new) ", [&](size_t i)
+            {
+                Record record(i, key.size(), size, key, value, kNewValue);
+                record.build_buffer(buffer.get());
+                return record.crc; });
+        cout << "  (" << sink % 10 << ")" << endl;
+    }
+}
+
+// 三个层次的校验各自的开销：get 时校验 value（mmap 和 pread 两种读法）、
+// 恢复时逐条校验 crc、后台完整扫描只读文件
+void bench_verify(size_t n)
+{
+    for (size_t value_size : {100, 4096})
+    {
+        string value(value_size, 'x');
+        Options options = bench_options("verify");
+        options.max_log_size = 16 << 20;
+        options.sync_mode = kSyncNone;
+        {
+            Bitcask db(options);
+            for (size_t i = 0; i < n; i++)
+                db.set(make_key(i), value);
+        }
+
+        mt19937_64 rng(1);
+        vector<string> keys;
+        for (size_t i = 0; i < n; i++)
+            keys.push_back(make_key(rng() % n));
+
+        cout << "value size: " << value_size << endl;
+        for (int mmap_sealed = 1; mmap_sealed >= 0; mmap_sealed--)
+        {
+            for (int verify = 0; verify <= 1; verify++)
+            {
+                options.mmap_sealed = mmap_sealed;
+                options.verify_reads = verify;
+                Bitcask db(options);
+
+                string got;
+                auto t1 = chrono::high_resolution_clock::now();
+                for (auto &key : keys)
+                    db.get(key, &got);
+                auto t2 = chrono::high_resolution_clock::now();
+                chrono::duration<double, nano> ns = t2 - t1;
+                cout << "  " << (mmap_sealed ? "mmap " : "pread") << (verify ? " verified" : "         ")
+                     << " get: " << ns.count() / n << " ns" << endl;
+            }
+        }
+
+        for (int verify = 1; verify >= 0; verify--)
+        {
+            for (const auto &entry : fs::directory_iterator(options.path))
+            {
+                if (entry.path().extension() == kHintSuffix)
+                    fs::remove(entry.path());
+            }
+            options.verify_recovery = verify;
+            auto t1 = chrono::high_resolution_clock::now();
+            Bitcask db(options);
+            auto t2 = chrono::high_resolution_clock::now();
+            chrono::duration<double, milli> ms = t2 - t1;
+            cout << "  scan recovery " << (verify ? "verified" : "unchecked") << ": " << ms.count() << " ms" << endl;
+
+            if (!verify)
+            {
+                auto t3 = chrono::high_resolution_clock::now();
+                size_t corrupted = db.scrub();
+                auto t4 = chrono::high_resolution_clock::now();
+                chrono::duration<double> s = t4 - t3;
+                double mb = (double)n * record_size(17, value_size) / (1 << 20);
+                cout << "  scrub: " << mb / s.count() << " MB/s  (" << corrupted << " corrupted)" << endl;
+            }
+        }
+        fs::remove_all(options.path);
+    }
+}
+
+// 写路径：原来的做法（分配整条 record 的缓冲区、拷贝、write、释放）和现在头部 + key + value
+// 三段 writev 的对比，再加上经过组提交的 set，value 从 1KB 到 16MB
+void bench_write()
+{
+    const size_t total = 256 << 20;
+    string key = make_key(42);
+    Options options = bench_options("write");
+    options.sync_mode = kSyncNone;
+    options.max_log_size = 1 << 30;
+    fs::create_directories(options.path);
+    string raw_path = options.path + "raw";
+
+    for (size_t size = 1 << 10; size <= 16 << 20; size *= 4)
+    {
+        string value(size, 'v');
+        size_t rounds = std::max<size_t>(total / size, 16);
+        double mb = (double)rounds * size / (1 << 20);
+        cout << "value size: " << size << endl;
+
+        for (int mode = 0; mode < 2; mode++)
+        {
+            int fd = open(raw_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, S_IRWXU);
+            auto t1 = chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < rounds; i++)
+            {
+                Record record(i, key.size(), size, key, value, kNewValue);
+                if (mode == 0)
+                {
+                    char *temp = new char[record.record_size()];
+                    record.build_buffer(temp);
+                    if (::write(fd, temp, record.record_size()) != (ssize_t)record.record_size())
+                        cout << "write failed" << endl;
+                    delete[] temp;
+                }
+                else
+                {
+                    record.build_head();
+                    struct iovec iovs[3] = {{record.head, record.head_len},
+                                            {(void *)key.data(), key.size()},
+                                            {(void *)value.data(), size}};
+                    if (::writev(fd, iovs, 3) != (ssize_t)record.record_size())
+                        cout << "writev failed" << endl;
+                }
+            }
+            auto t2 = chrono::high_resolution_clock::now();
+            close(fd);
+            unlink(raw_path.c_str());
+            chrono::duration<double> s = t2 - t1;
+            cout << (mode == 0 ? "  copy + write : " : "  writev       : ") << mb / s.count() << " MB/s" << endl;
+        }
+
+        {
+            Bitcask db(options);
+            auto t1 = chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < rounds; i++)
+                db.set(key, value);
+            auto t2 = chrono::high_resolution_clock::now();
+            chrono::duration<double> s = t2 - t1;
+            cout << "  Bitcask::set : " << mb / s.count() << " MB/s" << endl;
+        }
+        fs::remove_all(options.path);
+        fs::create_directories(options.path);
+    }
+    fs::remove_all(options.path);
+}
+
+// 覆盖写 n 次，后台合并不限速和限速时各跑一遍，比较 set 的延迟分布和回收的空间。
+// 切换数据文件和每轮合并都会打印，测量期间先把 cout 关掉
+void bench_compact(size_t n)
+{
+    string value(200, 'c');
+    size_t keys = std::max<size_t>(n / 10, 1);
+
+    for (uint64_t rate : {0ull, 16ull << 20})
+    {
+        Options options = bench_options("compact");
+        options.sync_mode = kSyncNone;
+        options.max_log_size = 1 << 20;
+        options.compact_threshold = 4 << 20;
+        options.compact_interval_ms = 100;
+        options.compact_rate_bytes = rate;
+
+        vector<uint64_t> latency(n);
+        size_t files;
+        uint64_t reclaimed;
+        double merge_avg_us;
+        {
+            Bitcask db(options);
+            mt19937_64 rng(42);
+            cout.setstate(ios::failbit);
+            for (size_t i = 0; i < n; i++)
+            {
+                string key = make_key(rng() % keys);
+                uint64_t start = now_ns();
+                db.set(key, value);
+                latency[i] = now_ns() - start;
+            }
+            this_thread::sleep_for(chrono::milliseconds(500));
+            cout.clear();
+            files = db.compacted_files();
+            reclaimed = db.reclaimed_bytes();
+            merge_avg_us = db.compact_stats().avg_us();
+        }
+
+        sort(latency.begin(), latency.end());
+        auto pct = [&](double p)
+        { return latency[std::min(n - 1, (size_t)(n * p))] / 1000.0; };
+        cout << "rate limit: " << (rate ? to_string(rate >> 20) + " MB/s" : string("none"))
+             << "  set p50: " << pct(0.5) << " us  p99: " << pct(0.99) << " us  p99.9: " << pct(0.999)
+             << " us  max: " << latency.back() / 1000.0 << " us" << endl
+             << "  merged files: " << files << "  reclaimed: " << (reclaimed >> 20) << " MB"
+             << "  merge avg: " << merge_avg_us / 1000 << " ms" << endl;
+        fs::remove_all(options.path);
+    }
+}
+
+// 批量导入：逐条 set 和每 1000 条一个 WriteBatch，每次组提交都刷盘
+void bench_batch(size_t n)
+{
+    string value(100, 'b');
+    size_t singles = std::max<size_t>(n / 100, 1);
+
+    {
+        Options options = bench_options("batch");
+        Bitcask db(options);
+        auto t1 = chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < singles; i++)
+            db.set(make_key(i), value);
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double> s = t2 - t1;
+        cout << "set          ops/s: " << singles / s.count() << "  (" << singles << " keys)" << endl;
+    }
+
+    for (size_t batch_size : {10, 100, 1000})
+    {
+        Options options = bench_options("batch");
+        Bitcask db(options);
+        WriteBatch batch;
+        auto t1 = chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < n; i++)
+        {
+            batch.set(make_key(i), value);
+            if (batch.count() == batch_size || i == n - 1)
+            {
+                db.write(batch);
+                batch.clear();
+            }
+        }
+        auto t2 = chrono::high_resolution_clock::now();
+        chrono::duration<double> s = t2 - t1;
+        cout << "batch " << batch_size << (batch_size < 100 ? "  " : batch_size < 1000 ? " " : "")
+             << "   ops/s: " << n / s.count() << "  (" << n << " keys)" << endl;
+    }
+    fs::remove_all("bench_data/batch/");
+}
+
+// 一次取一批 key：逐个 get 和 multi_get 对比。随机取的 key 分散在各个文件里，
+// 连续写入的一段 key 在文件里也相邻，能合并成大块读；数据文件不做 mmap，都走 pread
+void bench_multiget(size_t n)
+{
+    string value(100, 'm');
+    Options options = bench_options("multiget");
+    options.max_log_size = 4 << 20;
+    options.sync_mode = kSyncNone;
+    options.mmap_sealed = false;
+
+    Bitcask db(options);
+    for (size_t i = 0; i < n; i++)
+        db.set(make_key(i), value);
+
+    mt19937_64 rng(7);
+    for (size_t fanout : {50, 500})
+    {
+        for (int clustered = 0; clustered < 2; clustered++)
+        {
+            size_t rounds = std::max<size_t>(n / fanout, 1);
+            vector<vector<string>> requests(rounds);
+            for (auto &keys : requests)
+            {
+                size_t base = rng() % (n - std::min(n, fanout) + 1);
+                for (size_t i = 0; i < fanout; i++)
+                    keys.push_back(make_key(clustered ? base + i : rng() % n));
+            }
+
+            double ns[2];
+            for (int mode = 0; mode < 2; mode++)
+            {
+                auto t1 = chrono::high_resolution_clock::now();
+                for (auto &keys : requests)
+                {
+                    if (mode == 0)
+                    {
+                        string got;
+                        for (auto &key : keys)
+                            db.get(key, &got);
+                    }
+                    else
+                    {
+                        vector<string> got;
+                        db.multi_get(keys, &got);
+                    }
+                }
+                auto t2 = chrono::high_resolution_clock::now();
+                ns[mode] = chrono::duration<double, nano>(t2 - t1).count() / (rounds * fanout);
+            }
+            cout << "fanout " << fanout << (clustered ? "  clustered" : "  random   ")
+                 << "  get: " << ns[0] << " ns/key  multi_get: " << ns[1] << " ns/key" << endl;
+        }
+    }
+    fs::remove_all("bench_data/multiget/");
+}
+
+// YCSB 的 Zipfian 生成器：返回 [0, n)，0 最热，theta 越大越集中
+class ZipfianGenerator
+{
+private:
+    size_t n;
+    double theta, alpha, zetan, eta;
+
+    static double zeta(size_t n, double theta)
+    {
+        double sum = 0;
+        for (size_t i = 1; i <= n; i++)
+            sum += 1 / pow((double)i, theta);
+        return sum;
+    }
+
+public:
+    ZipfianGenerator(size_t n, double theta = 0.99) : n(n), theta(theta)
+    {
+        alpha = 1 / (1 - theta);
+        zetan = zeta(n, theta);
+        eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zetan);
+    }
+
+    size_t next(mt19937_64 &rng)
+    {
+        double u = uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1)
+            return 0;
+        if (uz < 1 + pow(0.5, theta))
+            return 1;
+        return std::min<size_t>(n - 1, (size_t)(n * pow(eta * u - eta + 1, alpha)));
+    }
+};
+
+// Zipfian 分布的随机读，value 缓存关掉和容量为数据量的 1%、10%、50% 时各跑一遍
+void bench_cache(size_t n)
+{
+    string value(100, 'c');
+    size_t data_bytes = n * value.size();
+    ZipfianGenerator zipf(n);
+
+    // 热点 key 打散到整个 key 空间里
+    vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++)
+        order[i] = i;
+    shuffle(order.begin(), order.end(), mt19937_64(1));
+
+    for (size_t percent : {0, 1, 10, 50})
+    {
+        Options options = bench_options("cache");
+        options.sync_mode = kSyncNone;
+        options.mmap_sealed = false;
+        options.cache_bytes = data_bytes * percent / 100;
+
+        Bitcask db(options);
+        for (size_t i = 0; i < n; i++)
+            db.set(make_key(i), value);
+
+        // 先预热一轮，只统计第二轮
+        mt19937_64 rng(9);
+        vector<string> keys;
+        for (size_t i = 0; i < n; i++)
+            keys.push_back(make_key(order[zipf.next(rng)]));
+        string got;
+        for (auto &key : keys)
+            db.get(key, &got);
+        CacheStats warm = db.cache_stats();
+
+        shuffle(keys.begin(), keys.end(), rng);
+        auto t1 = chrono::high_resolution_clock::now();
+        for (auto &key : keys)
+            db.get(key, &got);
+        auto t2 = chrono::high_resolution_clock::now();
+
+        CacheStats stats = db.cache_stats();
+        stats.hits -= warm.hits;
+        stats.misses -= warm.misses;
+        stats.evictions -= warm.evictions;
+        double ns = chrono::duration<double, nano>(t2 - t1).count() / n;
+        cout << "cache " << percent << "%  get: " << ns << " ns  hit ratio: "
+             << (stats.hits + stats.misses ? (double)stats.hits / (stats.hits + stats.misses) : 0)
+             << "  evictions: " << stats.evictions << "  bytes: " << stats.bytes << endl;
+    }
+    fs::remove_all("bench_data/cache/");
+}
+
+// 4 到 32 字节的随机小 value，内联阈值取几个值，看索引每个 key 占多少内存、随机 get 多快
+void bench_inline(size_t n)
+{
+    for (size_t threshold : {0, 8, 16, 32})
+    {
+        Options options = bench_options("inline");
+        options.sync_mode = kSyncNone;
+        options.mmap_sealed = false;
+        options.inline_value_size = threshold;
+
+        Bitcask db(options);
+        mt19937_64 rng(5);
+        size_t inlined = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            string value(4 + rng() % 29, 'i');
+            inlined += value.size() <= threshold;
+            db.set(make_key(i), value);
+        }
+
+        vector<string> keys;
+        for (size_t i = 0; i < n; i++)
+            keys.push_back(make_key(rng() % n));
+        string got;
+        auto t1 = chrono::high_resolution_clock::now();
+        for (auto &key : keys)
+            db.get(key, &got);
+        auto t2 = chrono::high_resolution_clock::now();
+
+        cout << "inline <= " << threshold << "  inlined: " << inlined * 100 / n << "%"
+             << "  index bytes/key: " << (double)db.index_memory() / db.index_size()
+             << "  get: " << chrono::duration<double, nano>(t2 - t1).count() / n << " ns" << endl;
+    }
+    fs::remove_all("bench_data/inline/");
+}
+
+int main(int argc, char **argv)
+{
+    string name = argc > 1 ? argv[1] : "";
+    size_t n = argc > 2 ? stoull(argv[2]) : 1000000;
+
+    if (name == "keydir")
+        bench_keydir(n);
+    else if (name == "sharded")
+        bench_sharded(n);
+    else if (name == "readheavy")
+        bench_readheavy(n);
+    else if (name == "mmap")
+        bench_mmap(n);
+    else if (name == "uring")
+        bench_uring(n);
+    else if (name == "recovery")
+        bench_recovery(n);
+    else if (name == "crc")
+        bench_crc();
+    else if (name == "verify")
+        bench_verify(n);
+    else if (name == "write")
+        bench_write();
+    else if (name == "compact")
+        bench_compact(n);
+    else if (name == "batch")
+        bench_batch(n);
+    else if (name == "multiget")
+        bench_multiget(n);
+    else if (name == "cache")
+        bench_cache(n);
+    else if (name == "inline")
+        bench_inline(n);
+    else
+    {
+        cout << "usage: bench <keydir|sharded|readheavy|mmap|uring|recovery|crc|verify|write|compact|batch|multiget|cache|inline> [n]" << endl;
+        return 1;
+    }
+
+    return 0;
+}
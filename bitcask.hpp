@@ -1,120 +1,657 @@
+#pragma once
 
+
+#include <condition_variable>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <functional>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "async_reader.hpp"
+#include "cache.hpp"
+#include "keydir.hpp"
 #include "kvs.h"
 #include "logger.hpp"
+#include "manifest.hpp"
+#include "options.h"
+#include "scanner.hpp"
+#include "stats.h"
 #include "util.h"
 
 using namespace std;
 
-class Bitcask : BasicOperation
+// multi_get 合并读取：同一文件里相邻 value 之间的空隙不超过 kCoalesceGap 就合成一次 pread，单次最多 kMaxCoalesceSize
+const size_t kCoalesceGap = 4 << 10;
+const size_t kMaxCoalesceSize = 1 << 20;
+// 合并掉的文件还被读者持有时，合并线程每隔多久重试释放
+const uint64_t kReclaimIntervalMs = 100;
+// 迭代器建立时每段至少遍历多少个索引槽，段与段之间放开读锁
+const size_t kScanChunkSlots = 4096;
+// 迭代器每次预取后面多少个 value
+const size_t kIteratorPrefetch = 64;
+
+// 恢复时从一个数据文件里解析出来的全部条目，key 指向 hints 或者 Log 里攒下的 hint 内容
+struct RecoveredFile
+{
+    struct Entry
+    {
+        HintEntry hint;
+        size_t part; // 合并时按 key 的 hash 分区
+    };
+
+    Log *log;
+    std::string hints;
+    bool scanned = false;
+    std::vector<Entry> entries;
+
+    explicit RecoveredFile(Log *log) : log(log) {}
+};
+
+// 一个等待落盘的请求（一条 set/remove，或者一个 WriteBatch 的全部 record），由组提交的 leader 统一写入
+struct Writer
+{
+    Record *const *records;
+    size_t count;
+    bool done = false;
+    std::condition_variable cv;
+
+    Writer(Record *const *records, size_t count) : records(records), count(count) {}
+};
+
+// 一次批量读里的一个 value，slot 是结果放在输出数组里的位置
+struct ReadTarget
+{
+    ValueIndex index;
+    size_t slot;
+    size_t key_size; // 校验 crc 时要用
+};
+
+class KeyIterator;
+
+// 正在建立的迭代器快照：序列号小于 seq 的写入都已经进了索引。建立时分段遍历索引、段与段之间放开锁，
+// 这期间 apply 第一次覆盖或删除一个符合条件的 key 时，把它在快照里的版本直接交给迭代器
+struct ScanSnapshot
+{
+    uint64_t seq;
+    const std::function<bool(std::string_view)> *match;
+    KeyIterator *it;
+};
+
+class Bitcask : public BasicOperation
 {
 private:
-    static uint64_t tstamp_;
-    map<std::string, ValueIndex> index_;
-    size_t file_count = 0;
+    // 全局序列号：组提交的 leader 按写入顺序给每条 record 分配，恢复时从最大的 tstamp 接着往下分
+    std::atomic<uint64_t> sequence_{0};
+    // 只在 rwmutex 写锁下修改：组提交的 apply、恢复和合并装入索引，不对外开放
+    KeyDir index_;
+    std::atomic<size_t> file_count{0};
     Log *logger;
-    map<std::string, Log *> logs;
+    FileTable logs;
     mutable std::shared_mutex rwmutex;
+
+    std::mutex writers_mutex;
+    std::deque<Writer *> writers_;
+
+    Options options_;
+    LatencyStats commit_stats_;
+    LatencyStats flush_stats_;
+    std::thread flusher_;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+    bool stop_flush = false;
+
+    LatencyStats scrub_stats_;
+    std::atomic<size_t> scrub_errors_{0};
+    std::thread scrubber_;
+    std::mutex scrub_mutex;
+    std::condition_variable scrub_cv;
+    bool stop_scrub = false;
+
+    // 合并线程：按间隔或者被 apply 唤醒，每次合并一轮；merge_mutex 保证同一时刻只有一轮合并
+    LatencyStats compact_stats_;
+    std::atomic<size_t> compacted_files_{0};
+    std::atomic<uint64_t> reclaimed_bytes_{0};
+    std::thread compactor_;
     std::mutex compact_mutex;
+    std::condition_variable compact_cv;
+    bool stop_compact = false;
+    bool compact_pending = false;
+    std::mutex merge_mutex;
+    std::vector<uint32_t> obsolete_; // 已经合并掉、文件可能还没删的 id，只在 merge_mutex 下访问
+
+    std::unique_ptr<ValueCache> cache_; // cache_bytes 为 0 时为空
+
+    // 已经写进索引的最大序列号加一，在 rwmutex 下读写
+    uint64_t applied_sequence_ = 0;
+    // 正在建立的迭代器快照：注册、注销时持有读锁和 snapshot_mutex，apply 在写锁里读，不用再加锁
+    std::mutex snapshot_mutex;
+    std::vector<ScanSnapshot *> snapshots_;
+
+    std::unique_ptr<IoUring> write_ring_; // 只有组提交的 leader 使用
+    std::unique_ptr<AsyncReader> reader_;
+    std::once_flag reader_once_;
 
     size_t uncompacted = 0;
 
+    void commit(Record *const *records, size_t count);
+    void sync_log(Log *log);
+    void flush_loop();
+    void scrub_loop();
+    void compact_loop();
+    bool in_compact_window();
+    bool compact_stopped();
+    void throttle(RateLimiter &limiter, uint64_t bytes);
+    void apply(const Record &record, size_t value_offset);
     void recovery();
+    void load_file(RecoveredFile &file, size_t parts);
+    void scan_log(Log *log, bool verify);
+    bool locate(std::string_view key, ValueIndex *index, LogRef *log, std::string *inline_value = nullptr);
+    bool inlinable(size_t value_size) const
+    {
+        return options_.inline_value_size && value_size <= options_.inline_value_size && value_size <= kMaxInlineValueSize;
+    }
+    void read_sorted(std::vector<ReadTarget> &targets, std::unordered_map<uint32_t, LogRef> &files,
+                     std::string *values, Status *statuses);
+    KeyIterator make_iterator(const std::function<bool(std::string_view)> &match);
+    void snapshot_add(ScanSnapshot &snapshot, std::string_view key, const ValueIndex &index, std::string_view inline_value);
     void if_switch_logger();
-    void internel_compact(map<std::string, Log *> logs, map<std::string, ValueIndex> index, std::string cur_log_id);
+    size_t merge_files(const std::vector<Log *> &victims);
+    // 唤醒合并线程，调用者可能持有 rwmutex
     void compact()
     {
-        std::thread compact_thread(&Bitcask::internel_compact, this, logs, index_, logger->get_fn());
-        compact_thread.detach();
+        {
+            std::lock_guard lock(compact_mutex);
+            compact_pending = true;
+        }
+        compact_cv.notify_one();
     }
 
 public:
-    void index_add(const std::string &key, const ValueIndex &index);
-
-    void index_erase(const std::string &key);
-
-    void update_index(const string &key, size_t value_offset, size_t len);
-
-    static uint64_t get_tstamp()
-    {
-        return tstamp_++;
-    }
+    // 下一个还没分配的序列号
+    uint64_t sequence() const { return sequence_.load(std::memory_order_acquire); }
 
 public:
     Status get(const std::string &key, std::string *str_get);
+    Status get(const std::string &key, Slice *value);
+    // 异步读：回调在后台 io 线程里执行，也可能在调用线程里直接执行（value 已在内存中或者 key 不存在）
+    void get_async(const std::string &key, ReadCallback callback);
+    // 批量读：所有 key 在同一个索引快照里解析，按文件分组、按 offset 排序，
+    // 相邻的 value 合并成一次读。返回每个 key 的结果，value 按 keys 的顺序放在 values 里
+    std::vector<Status> multi_get(const std::vector<std::string> &keys, std::vector<std::string> *values);
+    // key 超过 kMaxKeySize、编码后超过 kMaxWriteSize 的写入返回 InvalidArgument
     Status set(const std::string &key, const std::string &value);
     Status remove(const std::string &key);
+    // 整组写入：一次追加、一次刷盘，索引在同一次加锁里更新
+    Status write(const WriteBatch &batch);
+
+    // 按 key 的字典序遍历 [start, end)，end 为空表示一直到最后。
+    // 索引是哈希表，不管范围多窄，建立迭代器都要把整个索引走一遍（O(总 key 数)），
+    // 再把命中的 key 拷出来排序（O(命中数) 的内存）。遍历分段进行，每段只持有读锁 kScanChunkSlots 个槽，
+    // 写入不会被整个遍历挡住；看到的是建立开始那一刻的快照
+    KeyIterator scan(const std::string &start, const std::string &end);
+    // 按 key 的字典序遍历所有以 prefix 开头的 key，代价同 scan
+    KeyIterator prefix(const std::string &prefix);
 
     void list_keys();
     void print_kv();
-    Bitcask() { recovery(); }
-    ~Bitcask() {}
+
+    // 组提交整体耗时与刷盘耗时，用来在几种 SyncMode 之间做取舍
+    const LatencyStats &commit_stats() const { return commit_stats_; }
+    const LatencyStats &flush_stats() const { return flush_stats_; }
+
+    // 完整校验一遍所有只读文件，返回坏 record 的条数；scrub_interval_ms 打开时由后台线程定期调用
+    size_t scrub();
+    // 后台校验每个文件的耗时，以及累计发现的坏 record 数
+    const LatencyStats &scrub_stats() const { return scrub_stats_; }
+    size_t scrub_errors() const { return scrub_errors_.load(); }
+
+    // 挑出失效字节占比最高的几个只读文件合并，返回合并掉的文件数；合并线程定期调用，也可以直接调用
+    size_t compact_round();
+    // 每轮合并的耗时、累计合并掉的文件数和回收的字节数
+    const LatencyStats &compact_stats() const { return compact_stats_; }
+    size_t compacted_files() const { return compacted_files_.load(); }
+    uint64_t reclaimed_bytes() const { return reclaimed_bytes_.load(); }
+
+    // 内存索引的 key 数和占用的字节数（槽数组加 arena，包括内联的 value）
+    size_t index_size() const { return index_.size(); }
+    size_t index_memory() const { return index_.memory_usage(); }
+
+    // value 缓存的命中、未命中、淘汰次数和占用字节数，没开缓存时全是 0
+    CacheStats cache_stats() const { return cache_ ? cache_->stats() : CacheStats(); }
+
+    Bitcask(const Options &options = Options());
+    ~Bitcask();
+
+    friend class KeyIterator;
 };
-uint64_t Bitcask::tstamp_ = 0;
 
-void Bitcask::index_add(const std::string &key, const ValueIndex &index)
+// 有序迭代器：创建时从索引挑出快照里要遍历的 key 和位置，并持有它们所在的文件，之后不再加锁，
+// 写入和合并都不会影响它看到的内容。数据文件只追加，持有的文件在迭代器销毁前不会被删，
+// 所以读到的都是快照里的 value。内联在索引里的 value 创建时直接拷贝，其余的按需读取，
+// 每次预取后面 kIteratorPrefetch 个，预取时按 (file, offset) 排序、合并相邻的读
+class KeyIterator
 {
-    index_[std::move(key)] = index;
-}
+private:
+    struct Entry
+    {
+        std::string key;
+        ValueIndex index;
+        std::string value; // index.inlined 时就是 value
+    };
+
+    Bitcask *db_;
+    std::vector<Entry> entries_;
+    std::unordered_map<uint32_t, LogRef> files_;
+    size_t pos_ = 0;
+    size_t window_ = 0; // values_ 和 statuses_ 里放的是 [window_, window_ + values_.size()) 的结果
+    std::vector<std::string> values_;
+    std::vector<Status> statuses_;
+
+    void prefetch()
+    {
+        window_ = pos_;
+        size_t count = std::min(kIteratorPrefetch, entries_.size() - pos_);
+        values_.assign(count, std::string());
+        statuses_.assign(count, Status(IoError, "read value failed ."));
 
-void Bitcask::index_erase(const std::string &key)
+        std::vector<ReadTarget> targets;
+        for (size_t i = 0; i < count; i++)
+        {
+            Entry &entry = entries_[pos_ + i];
+            if (entry.index.inlined)
+            {
+                values_[i] = std::move(entry.value);
+                statuses_[i] = Status(OK, "");
+            }
+            else
+                targets.push_back(ReadTarget{entry.index, i, entry.key.size()});
+        }
+        db_->read_sorted(targets, files_, values_.data(), statuses_.data());
+    }
+
+    friend class Bitcask;
+    KeyIterator(Bitcask *db) : db_(db) {}
+
+public:
+    KeyIterator(KeyIterator &&) = default;
+    KeyIterator &operator=(KeyIterator &&) = default;
+
+    bool valid() const { return pos_ < entries_.size(); }
+    void next()
+    {
+        pos_++;
+        if (valid() && pos_ >= window_ + values_.size())
+            prefetch();
+    }
+
+    const std::string &key() const { return entries_[pos_].key; }
+    const std::string &value() const { return values_[pos_ - window_]; }
+    // 当前 value 是否读成功
+    const Status &status() const { return statuses_[pos_ - window_]; }
+    // 快照里一共有多少个 key
+    size_t count() const { return entries_.size(); }
+};
+
+Bitcask::Bitcask(const Options &options) : options_(options)
 {
-    index_.erase(std::move(key));
+    if (options_.inline_value_size > kMaxInlineValueSize)
+    {
+        std::cout << "inline_value_size " << options_.inline_value_size << " too large, using "
+                  << kMaxInlineValueSize << std::endl;
+        options_.inline_value_size = kMaxInlineValueSize;
+    }
+    if (options_.max_log_size > kMaxLogSize)
+    {
+        std::cout << "max_log_size " << options_.max_log_size << " too large, using " << kMaxLogSize << std::endl;
+        options_.max_log_size = kMaxLogSize;
+    }
+    if (options_.cache_bytes)
+        cache_.reset(new ValueCache(options_.cache_bytes, options_.cache_shards));
+    recovery();
+    if (options_.use_io_uring)
+    {
+        write_ring_.reset(new IoUring(4));
+        if (!write_ring_->ok())
+            write_ring_.reset();
+    }
+    if (options_.sync_mode == kSyncInterval)
+        flusher_ = std::thread(&Bitcask::flush_loop, this);
+    if (options_.scrub_interval_ms)
+        scrubber_ = std::thread(&Bitcask::scrub_loop, this);
+    compactor_ = std::thread(&Bitcask::compact_loop, this);
 }
 
-void Bitcask::update_index(const string &key, size_t value_offset, size_t len)
+Bitcask::~Bitcask()
 {
-    ValueIndex index(logger->get_fn(), value_offset, len);
-    index_[std::move(key)] = index;
+    {
+        std::lock_guard lock(compact_mutex);
+        stop_compact = true;
+    }
+    compact_cv.notify_all();
+    compactor_.join();
+    if (scrubber_.joinable())
+    {
+        {
+            std::lock_guard lock(scrub_mutex);
+            stop_scrub = true;
+        }
+        scrub_cv.notify_one();
+        scrubber_.join();
+    }
+    if (flusher_.joinable())
+    {
+        {
+            std::lock_guard lock(flush_mutex);
+            stop_flush = true;
+        }
+        flush_cv.notify_one();
+        flusher_.join();
+    }
+    if (options_.sync_mode != kSyncNone && logger->unsynced())
+        sync_log(logger);
 }
 
 Status Bitcask::set(const std::string &key, const std::string &value)
 {
-    size_t key_size = key.size(), value_size = value.size();
-    size_t record_size = kInfoHeadSize + key_size + value_size + kValueTypeSize;
+    if (key.size() > kMaxKeySize)
+        return Status(InvalidArgument, "key too long");
+    if (record_size(key.size(), value.size()) > kMaxWriteSize)
+        return Status(InvalidArgument, "value too large");
+
+    Record record(0, key.size(), value.size(), key, value, kNewValue);
+    Record *records[] = {&record};
+    commit(records, 1);
+
+    return Status(OK, std::string(strerror(errno)));
+}
+
+Status Bitcask::write(const WriteBatch &batch)
+{
+    if (batch.empty())
+        return Status(OK, "");
+    if (batch.bytes() > kMaxWriteSize)
+        return Status(InvalidArgument, "batch too large");
+
+    std::vector<Record> records;
+    std::vector<Record *> pointers;
+    records.reserve(batch.count());
+    pointers.reserve(batch.count());
+    for (auto &op : batch.ops())
+    {
+        if (op.key.size() > kMaxKeySize)
+            return Status(InvalidArgument, "key too long");
+        records.emplace_back(0, op.key.size(), op.value.size(), op.key, op.value, op.type);
+        pointers.push_back(&records.back());
+    }
+    commit(pointers.data(), pointers.size());
 
-    Record record(get_tstamp(), key_size, value_size, key, value, kNewValue);
+    return Status(OK, "");
+}
 
-    //同一个文件拿到logger锁的人才能操作logger去写入
-    rwmutex.lock();
-    if (index_.find(key) != index_.end())
+// 组提交：排在队首的 writer 成为 leader，把队列里的 record 一次 writev + fdatasync 写入，
+// 更新索引后统一唤醒这一批 writer。一个 writer 的 record 总是整组进同一批
+void Bitcask::commit(Record *const *records, size_t count)
+{
+    Writer w(records, count);
+
+    std::unique_lock lock(writers_mutex);
+    writers_.push_back(&w);
+    while (!w.done && &w != writers_.front())
+        w.cv.wait(lock);
+    if (w.done)
+        return;
+
+    std::vector<Record *> batch;
+    size_t batch_size = 0, batch_writers = 0;
+    for (auto writer : writers_)
     {
-        uncompacted += index_[key].len + kInfoHeadSize + kValueTypeSize + key_size;
-        std::cout << "uncompacted : " << uncompacted << std::endl;
-        if (uncompacted >= kCompactThreshold)
+        size_t writer_size = 0;
+        for (size_t i = 0; i < writer->count; i++)
+            writer_size += writer->records[i]->record_size();
+        if (batch_writers && batch_size + writer_size > kMaxBatchSize)
+            break;
+        batch.insert(batch.end(), writer->records, writer->records + writer->count);
+        batch_size += writer_size;
+        batch_writers++;
+    }
+    lock.unlock();
+
+    // 同一时刻只有一个 leader，logger 的写入不需要再加锁；序列号也在这里分配，
+    // 文件里、索引里的先后顺序和序列号的大小一致
+    uint64_t start = now_ns();
+    for (auto record : batch)
+        record->time_stamp = sequence_.fetch_add(1, std::memory_order_acq_rel);
+    std::vector<size_t> value_offsets;
+
+    switch (options_.sync_mode)
+    {
+    case kSyncAlways:
+        if (write_ring_)
+        {
+            // fdatasync 链在 writev 后面一起提交，这里的刷盘耗时包含了写入
+            logger->write_batch(batch, value_offsets, write_ring_.get(), true);
+            flush_stats_.add(now_ns() - start);
+        }
+        else
         {
-            std::cout << "call compact()" << std::endl;
-            uncompacted = 0;
-            compact();
+            logger->write_batch(batch, value_offsets);
+            sync_log(logger);
         }
+        break;
+    case kSyncInterval:
+        logger->write_batch(batch, value_offsets, write_ring_.get());
+        if (logger->unsynced() >= options_.sync_bytes)
+            flush_cv.notify_one();
+        break;
+    case kSyncNone:
+        logger->write_batch(batch, value_offsets, write_ring_.get());
+        break;
     }
-    size_t value_offset = logger->write(record, record_size);
-    update_index(key, value_offset, record.value_size);
-    if_switch_logger();
-    rwmutex.unlock();
 
-    return Status(OK, std::string(strerror(errno)));
+    {
+        std::unique_lock rw_lock(rwmutex);
+        for (size_t i = 0; i < batch.size(); i++)
+            apply(*batch[i], value_offsets[i]);
+        if_switch_logger();
+    }
+    commit_stats_.add(now_ns() - start);
+
+    lock.lock();
+    for (size_t i = 0; i < batch_writers; i++)
+    {
+        Writer *writer = writers_.front();
+        writers_.pop_front();
+        if (writer != &w)
+        {
+            writer->done = true;
+            writer->cv.notify_one();
+        }
+    }
+    if (!writers_.empty())
+        writers_.front()->cv.notify_one();
 }
 
-Status Bitcask::get(const std::string &key, std::string *value)
+void Bitcask::sync_log(Log *log)
 {
-    std::shared_lock lock(rwmutex);
+    uint64_t start = now_ns();
+    log->sync();
+    flush_stats_.add(now_ns() - start);
+}
+
+// kSyncInterval 的后台刷盘线程：每隔 sync_interval_ms，或者被 leader 因为未刷盘字节过多唤醒时刷一次；
+// sync_interval_ms 为 0 时只在被唤醒时刷
+void Bitcask::flush_loop()
+{
+    std::unique_lock lock(flush_mutex);
+    while (!stop_flush)
+    {
+        if (options_.sync_interval_ms)
+            flush_cv.wait_for(lock, std::chrono::milliseconds(options_.sync_interval_ms));
+        else
+            flush_cv.wait(lock);
+        if (stop_flush)
+            break;
+        lock.unlock();
+
+        LogRef log;
+        {
+            std::shared_lock rw_lock(rwmutex);
+            log = logs.acquire(logger->id());
+        }
+        if (log->unsynced())
+            sync_log(log.get());
+
+        lock.lock();
+    }
+}
 
-    if (index_.find(key) != index_.end())
+// 后台校验线程：每隔 scrub_interval_ms 把所有只读文件完整扫一遍
+void Bitcask::scrub_loop()
+{
+    std::unique_lock lock(scrub_mutex);
+    while (!stop_scrub)
+    {
+        scrub_cv.wait_for(lock, std::chrono::milliseconds(options_.scrub_interval_ms));
+        if (stop_scrub)
+            break;
+        lock.unlock();
+        scrub();
+        lock.lock();
+    }
+}
+
+size_t Bitcask::scrub()
+{
+    uint32_t active_id;
     {
-        ValueIndex index = index_[key];
-        std::unique_ptr<char[]> raw_value{new char[index.len]};
+        std::shared_lock rw_lock(rwmutex);
+        active_id = logger->id();
+    }
 
-        auto iter = logs.find(index.filename);
+    size_t corrupted = 0;
+    for (const LogRef &log : logs.snapshot())
+    {
+        if (log->id() >= active_id)
+            continue;
 
-        if (iter->second->read(index, raw_value.get()))
+        uint64_t start = now_ns();
+        LogScanner scanner(log->get_fd(), log->size());
+        LogEntry entry;
+        while (scanner.next(&entry))
+        {
+            if (!entry.valid())
+            {
+                corrupted++;
+                std::cout << "scrub: checksum mismatch in " << log->get_fn() << " at offset " << entry.offset << std::endl;
+            }
+        }
+        if (!scanner.finished())
         {
-            *value = std::string(raw_value.get(), index.len);
+            corrupted++;
+            std::cout << "scrub: unreadable record in " << log->get_fn() << " at offset " << scanner.offset() << std::endl;
+        }
+        scrub_stats_.add(now_ns() - start);
+
+        std::lock_guard lock(scrub_mutex);
+        if (stop_scrub)
+            break;
+    }
+
+    scrub_errors_ += corrupted;
+    return corrupted;
+}
+
+// 持有 rwmutex 写锁时调用，把一条已落盘的 record 应用到索引上，
+// 被覆盖或删除的旧 record 记到它所在文件的失效字节里
+void Bitcask::apply(const Record &record, size_t value_offset)
+{
+    ValueIndex old;
+    bool exist;
+
+    if (record.value_type == kNewValue)
+        exist = index_.put(record.key, ValueIndex(logger->id(), value_offset, record.value_size, record.time_stamp), &old,
+                           inlinable(record.value_size) ? record.value.data() : nullptr);
+    else
+    {
+        exist = index_.erase(record.key, &old);
+        // 删除标记本身也不是有效数据
+        logger->add_dead(record.record_size());
+        uncompacted += record.record_size();
+    }
+
+    // 注册以后第一次改动这个 key，旧版本就是迭代器快照里的那个；内联的 value 已经找不到了，从文件里读
+    if (exist)
+    {
+        old.inlined = false;
+        for (ScanSnapshot *snapshot : snapshots_)
+        {
+            if (old.tstamp < snapshot->seq && (*snapshot->match)(record.key))
+                snapshot_add(*snapshot, record.key, old, std::string_view());
+        }
+    }
+    applied_sequence_ = record.time_stamp + 1;
+
+    if (exist)
+    {
+        Log *log = logs.get(old.file_id);
+        size_t bytes = log ? log->record_bytes(record.key_size, old.len) : record_size(record.key_size, old.len);
+        if (log)
+            log->add_dead(bytes);
+        uncompacted += bytes;
+        if (cache_)
+            cache_->erase(old);
+    }
+
+    if (uncompacted >= options_.compact_threshold)
+    {
+        uncompacted = 0;
+        compact();
+    }
+}
+
+// 读路径不加 rwmutex：KeyDir::find 和 FileTable::acquire 都是无锁的。
+// 合并可能在两步之间提交并摘掉旧文件，这时索引已经指向新文件，重查一次即可；
+// 拿到引用以后文件就不会被关闭，旧位置依然可读。
+// 给了 inline_value 并且 value 内联在索引里时直接拷贝出来，不去拿文件
+bool Bitcask::locate(std::string_view key, ValueIndex *index, LogRef *log, std::string *inline_value)
+{
+    for (int attempt = 0; attempt < 3; attempt++)
+    {
+        if (!index_.find(key, index, inline_value))
+            return false;
+        if (inline_value && index->inlined)
+            break;
+        if ((*log = logs.acquire(index->file_id)))
+            break;
+    }
+    return true;
+}
+
+Status Bitcask::get(const std::string &key, std::string *value)
+{
+    ValueIndex index;
+    LogRef log;
+    if (locate(key, &index, &log, value))
+    {
+        if (index.inlined)
+            return Status(OK, "");
+        if (cache_ && cache_->lookup(index, value))
+            return Status(OK, "");
+        value->resize(index.len);
+
+        bool valid = true;
+        if (log && (options_.verify_reads ? log->read_verified(index, key.size(), value->data(), &valid)
+                                          : log->read(index, value->data())))
+        {
+            if (!valid)
+                return Status(Corrupted, "value checksum mismatch");
+            if (cache_)
+                cache_->insert(index, *value);
             return Status(OK, std::string(strerror(errno)));
         }
         else
@@ -128,225 +665,810 @@ Status Bitcask::get(const std::string &key, std::string *value)
     }
 }
 
-Status Bitcask::remove(const std::string &key)
+// 零拷贝读：value 在只读文件里时 Slice 直接指向 mmap 的映射，并持有它
+Status Bitcask::get(const std::string &key, Slice *value)
 {
-    size_t key_size = key.size();
-    size_t record_size = kInfoHeadSize + key_size + kValueTypeSize;
+    ValueIndex index;
+    LogRef log;
+    if (!locate(key, &index, &log))
+        return Status(IoError, "key not found");
 
-    Record record(get_tstamp(), key_size, 0, key, "", kRemoveValue);
+    if (log && log->read(index, value))
+    {
+        if (options_.verify_reads && !log->verify(index, key.size(), value->data()))
+            return Status(Corrupted, "value checksum mismatch");
+        return Status(OK, "");
+    }
+    return Status(IoError, std::string("read value failed .") + strerror(errno));
+}
 
-    if (index_.find(key) != index_.end())
+void Bitcask::get_async(const std::string &key, ReadCallback callback)
+{
+    ValueIndex index;
+    LogRef log;
+    std::string inline_value;
+    if (!locate(key, &index, &log, &inline_value))
     {
-        uncompacted += kInfoHeadSize + kValueTypeSize + key_size;
-        if (uncompacted >= kCompactThreshold)
+        callback(Status(IoError, "key not found"), "");
+        return;
+    }
+
+    if (index.inlined)
+    {
+        callback(Status(OK, ""), std::move(inline_value));
+        return;
+    }
+
+    if (!log)
+    {
+        callback(Status(IoError, "read value failed ."), "");
+        return;
+    }
+
+    // 只读文件已经映射在内存里，直接拷贝出来
+    if (log->sealed())
+    {
+        std::string value(index.len, '\0');
+        if (!log->read(index, value.data()))
+            callback(Status(IoError, "read value failed ."), "");
+        else if (options_.verify_reads && !log->verify(index, key.size(), value.data()))
+            callback(Status(Corrupted, "value checksum mismatch"), "");
+        else
+            callback(Status(OK, ""), std::move(value));
+        return;
+    }
+
+    // 回调持有文件的引用，读完之前 fd 不会被关闭；需要时校验放在 io 线程里、交给调用者之前做
+    int fd = log->get_fd();
+    callback = [log, index, key_size = key.size(), verify = options_.verify_reads,
+                done = std::move(callback)](Status status, std::string value)
+    {
+        if (verify && status.code == OK && !log->verify(index, key_size, value.data()))
+            done(Status(Corrupted, "value checksum mismatch"), "");
+        else
+            done(std::move(status), std::move(value));
+    };
+
+    std::call_once(reader_once_, [this]
+                   { reader_.reset(new AsyncReader(options_.io_depth, options_.use_io_uring)); });
+    reader_->submit(fd, index.offset, index.len, std::move(callback));
+}
+
+std::vector<Status> Bitcask::multi_get(const std::vector<std::string> &keys, std::vector<std::string> *values)
+{
+    std::vector<Status> statuses(keys.size(), Status(IoError, "key not found"));
+    values->assign(keys.size(), std::string());
+
+    std::vector<ReadTarget> targets;
+    std::unordered_map<uint32_t, LogRef> files;
+    {
+        // 读锁挡住组提交的 apply 和合并的提交，所有 key 看到的是同一时刻的索引，文件也都还在
+        std::shared_lock rw_lock(rwmutex);
+        for (size_t i = 0; i < keys.size(); i++)
         {
-            std::cout << "uncompacted : " << uncompacted << std::endl;
-            std::lock_guard lock(compact_mutex);
+            ValueIndex index;
+            if (!index_.find(keys[i], &index, &(*values)[i]))
+                continue;
+            if (index.inlined)
             {
-                compact();
-                uncompacted = 0;
+                statuses[i] = Status(OK, "");
+                continue;
             }
+            LogRef &log = files[index.file_id];
+            if (!log)
+                log = logs.acquire(index.file_id);
+            targets.push_back(ReadTarget{index, i, keys[i].size()});
         }
     }
 
-    std::unique_lock lock(rwmutex);
-    {
-        logger->write(record, record_size);
-        index_erase(key);
-        if_switch_logger();
-    }
-
-    return Status(OK, std::string(strerror(errno)));
+    read_sorted(targets, files, values->data(), statuses.data());
+    return statuses;
 }
 
-void Bitcask::recovery()
+// 批量读：按 (file, offset) 排序，只读文件已经映射在内存里、逐个拷贝，活跃文件里相邻的 value 合并成一次 pread。
+// 结果按 slot 放进 values 和 statuses，files 里要有所有 target 所在的文件
+void Bitcask::read_sorted(std::vector<ReadTarget> &targets, std::unordered_map<uint32_t, LogRef> &files,
+                          std::string *values, Status *statuses)
 {
-    file_count = get_file_nums();
-    char *head_buffer = new char[kInfoHeadSize];
+    std::sort(targets.begin(), targets.end(), [](const ReadTarget &a, const ReadTarget &b)
+              { return a.index.file_id != b.index.file_id ? a.index.file_id < b.index.file_id
+                                                          : a.index.offset < b.index.offset; });
 
-    for (const auto &entry : fs::directory_iterator(DataPath))
+    std::string buffer;
+    for (size_t begin = 0, end; begin < targets.size(); begin = end)
     {
-        ssize_t fd;
-        std::string filename = std::string(entry.path().c_str());
+        const ValueIndex &first = targets[begin].index;
+        Log *log = files[first.file_id].get();
 
-        filename = filename.substr(DataPath.size(), filename.size() - DataPath.size()); // get the file prefix to open
+        // 只读文件已经映射在内存里，不需要合并；活跃文件往后合并到空隙太大或者读得太长为止
+        uint64_t start = first.offset, stop = start + first.len;
+        for (end = begin + 1; end < targets.size() && !log->sealed(); end++)
+        {
+            const ValueIndex &next = targets[end].index;
+            uint64_t next_stop = std::max<uint64_t>(stop, next.offset + next.len);
+            if (next.file_id != first.file_id || next.offset > stop + kCoalesceGap || next_stop - start > kMaxCoalesceSize)
+                break;
+            stop = next_stop;
+        }
 
-        logger = new Log(filename); // new a logger to handle the file
+        const char *base = nullptr;
+        if (end - begin > 1)
+        {
+            buffer.resize(stop - start);
+            if (log->read(ValueIndex(first.file_id, start, stop - start), buffer.data()))
+                base = buffer.data() - start;
+        }
 
-        if (logger->get_fn() == filename) //"xxx.log"
+        for (size_t i = begin; i < end; i++)
         {
-            fd = logger->get_fd();
-            if (fd != -1)
-                logs.insert(std::pair<std::string, Log *>(filename, logger));
+            const ValueIndex &index = targets[i].index;
+            size_t slot = targets[i].slot;
+            std::string &value = values[slot];
+            value.resize(index.len);
+
+            bool ok = base != nullptr;
+            if (base)
+                memcpy(value.data(), base + index.offset, index.len);
+            else if (end - begin == 1)
+                ok = log->read(index, value.data());
+            if (!ok)
+                statuses[slot] = Status(IoError, std::string("read value failed .") + strerror(errno));
+            else if (options_.verify_reads && !log->verify(index, targets[i].key_size, value.data()))
+                statuses[slot] = Status(Corrupted, "value checksum mismatch");
             else
-                std::cout << "open file failed when get file descriptor." << std::endl;
+                statuses[slot] = Status(OK, "");
         }
-        else
-            std::cout << "recovery logger open failed when open file :" << std::endl;
+    }
+}
 
-        size_t file_size = lseek(fd, 0, SEEK_END);
-        size_t offset = lseek(fd, 0, SEEK_SET);
+// 快照里的一个 key：持有它所在的文件，内联的 value 拷出来。调用者持有 rwmutex
+void Bitcask::snapshot_add(ScanSnapshot &snapshot, std::string_view key, const ValueIndex &index, std::string_view inline_value)
+{
+    KeyIterator &it = *snapshot.it;
+    LogRef &log = it.files_[index.file_id];
+    if (!log)
+        log = logs.acquire(index.file_id);
+    it.entries_.push_back(KeyIterator::Entry{std::string(key), index, std::string(index.inlined ? inline_value : std::string_view())});
+}
 
-        while (lseek(fd, 0, SEEK_CUR) != file_size) // file_size + 1 ?
+// 快照取的是注册那一刻的 applied_sequence_。分段遍历时只收 tstamp 小于它的版本，也就是注册以后没改过的 key；
+// 注册以后被覆盖、删除的 key 由 apply 在第一次改动时交上来。段的边界停在空槽上，期间的 backward shift
+// 不会把没遍历到的 key 挪进遍历过的区域；索引重建过就从头再走一遍，最后按 key 去重
+KeyIterator Bitcask::make_iterator(const std::function<bool(std::string_view)> &match)
+{
+    KeyIterator it(this);
+    ScanSnapshot snapshot{0, &match, &it};
+    size_t pos = 0;
+    uint64_t rebuilds = 0;
+    {
+        std::shared_lock rw_lock(rwmutex);
+        std::lock_guard lock(snapshot_mutex);
+        snapshot.seq = applied_sequence_;
+        rebuilds = index_.rebuilds();
+        snapshots_.push_back(&snapshot);
+    }
+
+    while (true)
+    {
+        std::shared_lock rw_lock(rwmutex);
+        if (index_.rebuilds() != rebuilds)
+        {
+            rebuilds = index_.rebuilds();
+            pos = 0;
+        }
+        if (pos >= index_.capacity())
         {
-            if (read(fd, (void *)head_buffer, kInfoHeadSize) != kInfoHeadSize)
-                std::cout << "read head_buffer failed" << strerror(errno) << std::endl;
+            std::lock_guard lock(snapshot_mutex);
+            snapshots_.erase(std::find(snapshots_.begin(), snapshots_.end(), &snapshot));
+            break;
+        }
+        pos = index_.for_each_from(pos, kScanChunkSlots, [&](std::string_view key, const ValueIndex &index, std::string_view inline_value)
+                                   {
+                                       if (index.tstamp < snapshot.seq && match(key))
+                                           snapshot_add(snapshot, key, index, inline_value); });
+    }
 
-            InfoHeader *head = (InfoHeader *)head_buffer;
-            char *key = new char[head->key_size];
+    // 索引是哈希表，挑出来的 key 排序后再遍历；同一个 key 收到的都是快照里的同一个版本，留一份即可
+    std::sort(it.entries_.begin(), it.entries_.end(), [](const auto &a, const auto &b)
+              { return a.key < b.key; });
+    it.entries_.erase(std::unique(it.entries_.begin(), it.entries_.end(), [](const auto &a, const auto &b)
+                                  { return a.key == b.key; }),
+                      it.entries_.end());
+    if (it.valid())
+        it.prefetch();
+    return it;
+}
 
-            if (read(fd, (void *)key, head->key_size) != head->key_size)
-            {
-                std::cout << "logger id: " << filename
-                          << " read for key failed." << strerror(errno) << std::endl;
-            }
+KeyIterator Bitcask::scan(const std::string &start, const std::string &end)
+{
+    return make_iterator([&](std::string_view key)
+                         { return key >= start && (end.empty() || key < end); });
+}
 
-            if (head->value_size)
-            {
-                std::string key_value(key, head->key_size);
-                size_t value_offset = lseek(fd, 0, SEEK_CUR);
+KeyIterator Bitcask::prefix(const std::string &prefix)
+{
+    return make_iterator([&](std::string_view key)
+                         { return key.substr(0, prefix.size()) == prefix; });
+}
 
-                ValueIndex index(filename, value_offset, head->value_size);
 
-                if (index_.find(key_value) != index_.end()) // if key exit..
-                {
-                    uncompacted += index_[key].len + kInfoHeadSize + kValueTypeSize + head->key_size + head->value_size;
-                }
+Status Bitcask::remove(const std::string &key)
+{
+    if (key.size() > kMaxKeySize)
+        return Status(InvalidArgument, "key too long");
 
-                index_add(key_value, index);                            // update key with the index in the Memory
-                lseek(fd, head->value_size + kValueTypeSize, SEEK_CUR); // ignore the value and valueType section
-            }
-            else
+    const std::string value;
+    Record record(0, key.size(), 0, key, value, kRemoveValue);
+    Record *records[] = {&record};
+    commit(records, 1);
+
+    return Status(OK, std::string(strerror(errno)));
+}
+
+// 恢复分三步：多线程各自加载一个数据文件（读 hint 或扫描）；按 key 的 hash 分区并行合并，
+// 同一个 key 取 tstamp（序列号）最大的版本。序列号全局唯一，相同的只会是合并留下的同一条 record 的两份拷贝，
+// 这时取 file id 更大、文件里更靠后的；最后把结果连同序列号写进索引
+void Bitcask::recovery()
+{
+    fs::create_directories(options_.path);
+
+    // 上次合并已经提交、还没来得及删的旧文件，先删掉再加载
+    std::vector<uint32_t> obsolete;
+    if (!manifest_load(options_.path, &obsolete))
+        std::cout << "manifest corrupted, ignored." << std::endl;
+    for (uint32_t id : obsolete)
+    {
+        unlink((options_.path + std::to_string(id) + suffix).c_str());
+        unlink((options_.path + std::to_string(id) + kHintSuffix).c_str());
+    }
+    if (!obsolete.empty())
+    {
+        unlink((options_.path + kManifestName).c_str());
+        sync_dir(options_.path);
+    }
+
+    std::vector<RecoveredFile> files;
+    for (const auto &entry : fs::directory_iterator(options_.path))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != suffix)
+            continue;
+
+        Log *log = new Log(entry.path().filename().string(), options_.path); // new a logger to handle the file
+        if (log->get_fd() < 0)
+        {
+            std::cout << "open file failed when get file descriptor." << std::endl;
+            delete log;
+            continue;
+        }
+        logs.add(log);
+        files.emplace_back(log);
+    }
+    std::sort(files.begin(), files.end(), [](const RecoveredFile &a, const RecoveredFile &b)
+              { return a.log->id() < b.log->id(); });
+    file_count = files.empty() ? 0 : files.back().log->id();
+
+    size_t threads = options_.recovery_threads ? options_.recovery_threads : std::thread::hardware_concurrency();
+    size_t parts = std::max<size_t>(threads, 1);
+
+    parallel_for(files.size(), threads, [&](size_t i)
+                 { load_file(files[i], parts); });
+
+    // 老格式文件里的 tstamp 不可信，按 (文件 id, 文件内位置) 重新编号，排在所有新格式序列号前面。
+    // 老格式文件 id 都比新格式文件小，合并只会删掉老格式文件，剩下的编号只会变小，已经换成新格式的 record 仍然排在前面
+    size_t legacy_records = 0;
+    uint64_t first_sequence = UINT64_MAX;
+    for (auto &file : files)
+    {
+        if (file.log->legacy())
+            legacy_records += file.entries.size();
+        else
+        {
+            for (auto &entry : file.entries)
+                first_sequence = std::min(first_sequence, entry.hint.tstamp);
+        }
+    }
+    if (legacy_records > first_sequence)
+        std::cout << "recovery: " << legacy_records << " legacy records do not fit below sequence " << first_sequence << std::endl;
+    uint64_t legacy_sequence = first_sequence >= legacy_records && first_sequence != UINT64_MAX ? first_sequence - legacy_records : 0;
+    for (auto &file : files)
+    {
+        if (!file.log->legacy())
+            continue;
+        file.log->rebase_tstamps(legacy_sequence, file.entries.size());
+        for (auto &entry : file.entries)
+            entry.hint.tstamp = legacy_sequence++;
+    }
+
+    struct Winner
+    {
+        const HintEntry *hint;
+        uint32_t file_id;
+    };
+    std::vector<std::unordered_map<std::string_view, Winner>> winners(parts);
+    parallel_for(parts, threads, [&](size_t part)
+                 {
+                     auto &winner = winners[part];
+                     for (auto &file : files) // 文件按 id 递增，文件内按写入顺序
+                     {
+                         for (auto &entry : file.entries)
+                         {
+                             if (entry.part != part)
+                                 continue;
+                             auto [iter, inserted] = winner.try_emplace(entry.hint.key, Winner{&entry.hint, file.log->id()});
+                             if (!inserted && entry.hint.tstamp >= iter->second.hint->tstamp)
+                                 iter->second = Winner{&entry.hint, file.log->id()};
+                         }
+                     } });
+
+    uint64_t max_tstamp = 0;
+    for (auto &file : files)
+    {
+        for (auto &entry : file.entries)
+            max_tstamp = std::max(max_tstamp, entry.hint.tstamp);
+    }
+    std::unordered_map<uint32_t, uint64_t> live; // file id -> 有效字节数
+    std::string inline_value;
+    for (auto &winner : winners)
+    {
+        for (auto &[key, w] : winner)
+        {
+            if (w.hint->type != kNewValue)
+                continue;
+            // hint 里没有 value，要内联的小 value 从数据文件里读出来
+            ValueIndex index(w.file_id, w.hint->value_offset, w.hint->value_size, w.hint->tstamp);
+            bool inlined = inlinable(index.len);
+            if (inlined)
             {
-                uncompacted += kInfoHeadSize + head->key_size + kValueTypeSize;
-                index_erase(std::string(key, head->key_size));
-                lseek(fd, kValueTypeSize, SEEK_CUR);
+                inline_value.resize(index.len);
+                inlined = logs.get(w.file_id)->read(index, inline_value.data());
             }
-            delete[] key;
+            index_.put(key, index, nullptr, inlined ? inline_value.data() : nullptr);
+            live[w.file_id] += logs.get(w.file_id)->record_bytes(key.size(), w.hint->value_size);
         }
     }
+    // 每个文件里不是有效数据的部分都算失效字节
+    for (auto &file : files)
+    {
+        uint64_t dead = file.log->data_size() - live[file.log->id()];
+        file.log->add_dead(dead);
+        uncompacted += dead;
+    }
+    if (!files.empty())
+    {
+        sequence_.store(max_tstamp + 1, std::memory_order_release);
+        applied_sequence_ = max_tstamp + 1;
+    }
 
     std::cout << "recovery umcompacted: " << uncompacted << std::endl;
 
-    if (uncompacted >= kCompactThreshold)
+    if (files.empty())
+    {
+        logger = new Log("0.log", options_.path);
+        logs.add(logger);
+    }
+    else
+    {
+        // id 最大的文件继续作为活跃文件，它的条目留到切换出去时写进 hint
+        logger = files.back().log;
+        if (!files.back().scanned)
+            logger->restore_hints(files.back().hints);
+    }
+
+    // 扫描过的只读文件补上 hint，下次启动就不用再扫；活跃文件的 hint 等它切换出去时再写
+    for (auto &file : files)
     {
-        // compact();
-        std::thread compact_thread(&Bitcask::internel_compact, this, logs, index_, logger->get_fn());
-        // compact_thread.detach();
-        compact_thread.join();
+        if (file.scanned && file.log != logger)
+            file.log->write_hint();
     }
 
-    if (file_count != 0)
-        if_switch_logger();
+    // 合并线程在恢复之后才启动，启动后马上检查一轮
+    if (uncompacted >= options_.compact_threshold)
+    {
+        uncompacted = 0;
+        compact_pending = true;
+    }
+
+    if_switch_logger();
+
+    if (options_.mmap_sealed)
+    {
+        logs.for_each([this](Log *log)
+                      {
+                          if (log != logger)
+                              log->seal(); });
+    }
+}
+
+// 有可用的 hint 文件就直接读 hint，否则扫描整个数据文件，顺便在 Log 里攒下 hint 条目
+void Bitcask::load_file(RecoveredFile &file, size_t parts)
+{
+    std::string_view hints;
+    if (hint_load(file.log->hint_path(), file.log->size(), &file.hints))
+        hints = file.hints;
     else
     {
-        logger = new Log("0.log");
-        logs.insert(std::pair<std::string, Log *>("0.log", logger));
+        scan_log(file.log, options_.verify_recovery);
+        file.scanned = true;
+        hints = file.log->pending_hints();
+    }
+
+    HintEntry hint;
+    size_t pos = 0;
+    while (hint_next(hints, pos, &hint))
+    {
+        file.entries.push_back(RecoveredFile::Entry{hint, std::hash<std::string_view>{}(hint.key) % parts});
+        file.log->note_tstamp(hint.tstamp);
+    }
+}
+
+// 没有 hint 时顺序扫描数据文件，攒成 hint 条目。遇到不完整的 record（写到一半崩溃）
+// 或者 crc 校验不过的 record，从它开始截掉文件剩下的部分
+void Bitcask::scan_log(Log *log, bool verify)
+{
+    LogScanner scanner(log->get_fd(), log->size());
+    LogEntry entry;
+    uint64_t valid_size = scanner.offset(); // 文件头之后
+    bool corrupted = false;
+    while (scanner.next(&entry))
+    {
+        if (verify && !entry.valid())
+        {
+            corrupted = true;
+            break;
+        }
+        log->add_hint(entry.tstamp, entry.key, entry.value_offset(), entry.value.size(), entry.type);
+        valid_size = entry.offset + entry.size();
     }
 
-    delete[] head_buffer;
+    if (corrupted || !scanner.finished())
+    {
+        std::cout << "logger id: " << log->get_fn() << (corrupted ? " checksum mismatch" : " incomplete record")
+                  << " at offset " << valid_size << ", truncate " << log->size() - valid_size << " bytes." << std::endl;
+        log->truncate(valid_size);
+    }
 }
 
 void Bitcask::list_keys()
 {
+    std::shared_lock lock(rwmutex);
     std::cout << "keys lists:" << endl;
-    for (const auto &kv : index_)
-        std::cout << "key: " << kv.first << endl;
+    index_.for_each([](std::string_view key, const ValueIndex &)
+                    { std::cout << "key: " << key << endl; });
 }
 
 void Bitcask::print_kv()
 {
-    for (const auto &kv : index_)
-    {
-        string str_get;
-        std::cout << "key: " << kv.first << "    ";
+    std::shared_lock lock(rwmutex);
+    index_.for_each([this](std::string_view key, const ValueIndex &)
+                    {
+                        string str_get;
+                        std::cout << "key: " << key << "    ";
 
-        get(kv.first, &str_get);
-        std::cout << "value: " << str_get << std::endl;
-    }
+                        get(std::string(key), &str_get);
+                        std::cout << "value: " << str_get << std::endl; });
 }
 
+// 文件写满了就切换到新文件；老格式文件不再追加，恢复后第一次调用时就切换出去
 void Bitcask::if_switch_logger() //   (Log *)*logger
 {
-    if (logger->size() > kLogSize)
+    if (logger->size() > options_.max_log_size || logger->legacy())
     {
-        size_t new_id = file_count + 1;
-        file_count++;
+        // 切换前把旧文件剩下的数据刷盘，之后后台线程只会去刷新的 logger
+        if (options_.sync_mode != kSyncNone && logger->unsynced())
+            sync_log(logger);
+        logger->write_hint();
+        if (options_.mmap_sealed)
+            logger->seal();
+
+        size_t new_id = ++file_count;
 
         std::string new_file(std::to_string(new_id) + std::string(".log"));
 
-        logger = new Log(new_file);
-        logs.insert(std::pair<string, Log *>(new_file, logger));
+        logger = new Log(new_file, options_.path);
+        logs.add(logger);
 
         std::cout << "new logger for file: " << new_id << std::endl;
     }
 }
 
-void Bitcask::internel_compact(map<std::string, Log *> logs, map<std::string, ValueIndex> index, std::string cur_log_name)
+// 合并线程：每隔 compact_interval_ms，或者被 apply 唤醒时，在允许的时间段里合并一轮
+void Bitcask::compact_loop()
 {
-    this->compact_mutex.lock();
-    std::cout << "compact:======================================>" << std::endl;
+    std::unique_lock lock(compact_mutex);
+    uint64_t last_round = now_ns();
+    while (!stop_compact)
+    {
+        auto woken = [this]
+        { return stop_compact || compact_pending; };
+        // 等到下一轮定时合并；还有合并掉、没释放的文件时最多等 kReclaimIntervalMs，不让它们一直占着磁盘和 fd
+        uint64_t wait_ms = 0;
+        if (options_.compact_interval_ms)
+        {
+            uint64_t elapsed = (now_ns() - last_round) / 1000000;
+            wait_ms = elapsed < options_.compact_interval_ms ? options_.compact_interval_ms - elapsed : 1;
+        }
+        if (logs.retired())
+            wait_ms = wait_ms ? std::min(wait_ms, kReclaimIntervalMs) : kReclaimIntervalMs;
+        if (wait_ms)
+            compact_cv.wait_for(lock, std::chrono::milliseconds(wait_ms), woken);
+        else
+            compact_cv.wait(lock, woken);
+        if (stop_compact)
+            break;
+        bool due = compact_pending || (options_.compact_interval_ms &&
+                                       now_ns() - last_round >= options_.compact_interval_ms * 1000000);
+        compact_pending = false;
+        lock.unlock();
+        if (due)
+        {
+            last_round = now_ns();
+            if (in_compact_window())
+                compact_round();
+        }
+        logs.reclaim();
+        lock.lock();
+    }
+}
 
-    map<std::string, Log *> new_logs;
-    map<std::string, ValueIndex> new_index;
+bool Bitcask::in_compact_window()
+{
+    int begin = options_.compact_window_begin, end = options_.compact_window_end;
+    if (begin == end)
+        return false;
+
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    int hour = local.tm_hour;
+    return begin < end ? hour >= begin && hour < end : hour >= begin || hour < end;
+}
 
-    int cur_id = get_log_id(cur_log_name);
+bool Bitcask::compact_stopped()
+{
+    std::lock_guard lock(compact_mutex);
+    return stop_compact;
+}
 
-    size_t new_log_start = file_count + 100;                       // new log file prefix
-    std::string new_file = std::to_string(new_log_start) + suffix; // make the "xxx.log" string
-    Log *target = new Log(new_file);
-    new_logs.insert(std::pair<std::string, Log *>(new_file, target));
+// 合并的读写按 compact_rate_bytes 限速，析构时等待会被打断
+void Bitcask::throttle(RateLimiter &limiter, uint64_t bytes)
+{
+    auto delay = limiter.request(bytes);
+    if (delay.count() > 0)
+    {
+        std::unique_lock lock(compact_mutex);
+        compact_cv.wait_for(lock, delay, [this]
+                            { return stop_compact; });
+    }
+}
 
-    for (auto &[key, index] : index) // 遍历索引表
-    {                                // key->file,offset,len
-        size_t log_id = get_log_id(index.filename);
+size_t Bitcask::compact_round()
+{
+    std::lock_guard merge_lock(merge_mutex);
+    uint64_t start = now_ns();
 
-        if (log_id < cur_id)
-        {
-            auto logger = logs[index.filename];
-            char *temp_value = new char[index.len];
+    // 锁里只取活跃文件的 id，之后新建的活跃文件 id 更大，一起排除在外
+    uint32_t active_id;
+    {
+        std::shared_lock rw_lock(rwmutex);
+        active_id = logger->id();
+    }
 
-            logger->read(index, temp_value);
+    // 比例在合并线程之外还会变，先取一次再排序。活跃文件的长度只有组提交的 leader 能读，先按 id 排除
+    std::vector<std::pair<double, Log *>> candidates;
+    logs.for_each([&](Log *log)
+                  {
+                      if (log->id() >= active_id)
+                          return;
+                      double ratio = log->garbage_ratio();
+                      if (ratio >= options_.compact_garbage_ratio)
+                          candidates.emplace_back(ratio, log); });
+    std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b)
+              { return a.first > b.first; });
+    if (candidates.size() > options_.compact_max_files)
+        candidates.resize(options_.compact_max_files);
+
+    std::vector<Log *> victims;
+    uint64_t garbage = 0;
+    for (auto &[ratio, log] : candidates)
+    {
+        victims.push_back(log);
+        garbage += log->dead_bytes();
+    }
+    if (victims.empty() || garbage < options_.compact_threshold)
+        return 0;
 
-            std::string test_value = std::string(temp_value, index.len); // get value
+    size_t merged = merge_files(victims);
+    if (merged)
+        compact_stats_.add(now_ns() - start);
+    return merged;
+}
 
-            // build record
-            Record temp_record(Bitcask::get_tstamp(), key.size(), index.len, key, test_value, kNewValue);
-            size_t record_size = kInfoHeadSize + key.size() + index.len + kValueTypeSize;
-            size_t value_offset = target->write(temp_record, record_size);
+// 顺序扫描 victims，把仍然有效的 record 原样拷进新文件，全部搬完后删除 victims。
+// 拷贝先攒在缓冲区里，满 kMaxBatchSize 写一次，每个输出文件只在写完时刷一次盘。
+// 不拷贝索引：逐条用无锁的 KeyDir::find 判断 record 是否有效，每写完一个输出文件就装进索引，
+// 装的时候只替换合并期间没有被改写过的 key，内存里最多留一个输出文件的 key。
+// 删除标记只在 key 已经被重新写入、或者其他文件里不可能还有更老的版本时才丢掉
+size_t Bitcask::merge_files(const std::vector<Log *> &victims)
+{
+    std::cout << "compact:======================================>" << std::endl;
 
-            // write into new_index
-            new_index[key] = std::move(ValueIndex(target->get_fn(), value_offset, index.len));
+    // 合并开始之后新写的文件 tstamp 都更大，不影响结果，不需要加锁；
+    // 只有合并会从表里摘文件，持有 merge_mutex 时裸指针一直有效
+    uint64_t oldest_other = UINT64_MAX; // victims 以外的文件里最小的 tstamp
+    logs.for_each([&](Log *log)
+                  {
+                      if (std::find(victims.begin(), victims.end(), log) == victims.end())
+                          oldest_other = std::min(oldest_other, log->min_tstamp()); });
 
-            if (target->size() > kLogSize) // when to switch to new log file
+    struct Moved
+    {
+        std::string key;
+        InfoType type;
+        ValueIndex from, to;
+    };
+    std::vector<Moved> moved; // 当前输出文件里的 record
+    std::string buffer;       // 还没有写进 target 的 record，攒够一大块再写
+    std::vector<Log *> outputs;
+    Log *target = nullptr;
+    RateLimiter limiter(options_.compact_rate_bytes);
+
+    auto flush = [&]
+    {
+        if (buffer.empty())
+            return;
+        target->append(buffer.data(), buffer.size());
+        throttle(limiter, buffer.size());
+        buffer.clear();
+    };
+    // 输出文件写完后一次刷盘、写 hint，然后装进索引；搬过去的 record 在原文件里变成失效字节
+    auto finish = [&]
+    {
+        flush();
+        target->write_hint();
+        if (options_.mmap_sealed)
+            target->seal();
+
+        std::unique_lock rw_lock(rwmutex);
+        logs.add(target);
+        for (auto &m : moved)
+        {
+            if (m.type != kNewValue)
+                continue;
+            ValueIndex cur;
+            if (index_.find(m.key, &cur) && cur.file_id == m.from.file_id && cur.offset == m.from.offset)
             {
-                size_t new_id = new_log_start + 1;
-                new_log_start++;
-                std::string new_file(std::to_string(new_id) + std::string(".log"));
+                index_.move(m.key, m.to);
+                Log *from = logs.get(m.from.file_id);
+                from->add_dead(from->record_bytes(m.key.size(), m.from.len));
+                if (cache_)
+                    cache_->erase(m.from);
+            }
+            else
+                target->add_dead(record_size(m.key.size(), m.to.len));
+        }
+        rw_lock.unlock();
 
-                target = new Log(new_file);
-                new_logs.insert(std::pair<std::string, Log *>(new_file, target));
+        outputs.push_back(target);
+        target = nullptr;
+        moved.clear();
+    };
 
-                std::cout << "new logger for file: " << new_id << std::endl;
+    bool failed = false;
+    for (Log *log : victims)
+    {
+        LogScanner scanner(log->get_fd(), log->size());
+        LogEntry entry;
+        uint64_t ordinal = 0; // 文件内第几条 record，老格式 record 用它换算恢复时编的序列号
+        while (!failed && scanner.next(&entry))
+        {
+            throttle(limiter, entry.size());
+            uint64_t tstamp = entry.legacy ? log->tstamp_base() + ordinal : entry.tstamp;
+            ordinal++;
+
+            ValueIndex cur;
+            bool keep;
+            if (entry.type == kNewValue)
+                keep = index_.find(entry.key, &cur) && cur.file_id == log->id() && cur.offset == entry.value_offset();
+            else
+                keep = !index_.contains(entry.key) && oldest_other <= tstamp;
+            if (!keep)
+                continue;
+
+            if (!target)
+                target = new Log(std::to_string(++file_count) + suffix, options_.path);
+            uint64_t value_offset;
+            if (!entry.legacy)
+            {
+                // 新格式 record 原样拷贝，crc 和 tstamp 都不用重新算；坏掉的 record 带着对不上的 crc 过去，照样能被发现
+                value_offset = target->size() + buffer.size() + entry.head_size + entry.key.size();
+                buffer.append(entry.data, entry.size());
             }
-            delete[] temp_value;
+            else
+            {
+                // 老格式 record 要换成新格式重新编码，先确认它是好的，免得换上新的 crc 把坏数据洗白
+                if (!entry.valid())
+                {
+                    std::cout << "compact: checksum mismatch in " << log->get_fn() << " at offset " << entry.offset << std::endl;
+                    failed = true;
+                    break;
+                }
+                std::string key(entry.key), value(entry.value);
+                Record record(tstamp, key.size(), value.size(), key, value, entry.type);
+                record.build_head();
+                value_offset = target->size() + buffer.size() + record.head_len + key.size();
+                buffer.append(record.head, record.head_len);
+                buffer.append(key);
+                buffer.append(value);
+            }
+            target->add_hint(tstamp, entry.key, value_offset, entry.value.size(), entry.type);
+            moved.push_back(Moved{std::string(entry.key), entry.type,
+                                  ValueIndex(log->id(), entry.value_offset(), entry.value.size()),
+                                  ValueIndex(target->id(), value_offset, entry.value.size(), tstamp)});
+
+            if (buffer.size() >= kMaxBatchSize)
+                flush();
+            if (target->size() + buffer.size() > options_.max_log_size)
+                finish();
+            failed = compact_stopped();
+        }
+        if (!failed && !scanner.finished())
+        {
+            std::cout << "compact: unreadable record in " << log->get_fn() << " at offset " << scanner.offset() << std::endl;
+            failed = true;
         }
+        if (failed)
+            break;
     }
 
-    for (auto &[fname, _] : logs) // delete all the old files
+    if (failed)
     {
-        // std::cout << DataPath + log.first << std::endl;
-        unlink((DataPath + fname).c_str());
+        // 中途停下或者遇到坏数据：已经装进索引的输出文件保留，没写完的丢掉，victims 留到下一轮
+        if (target)
+        {
+            target->remove();
+            delete target;
+        }
+        return 0;
     }
+    if (target)
+        finish();
+
+    // 提交：新文件都已落盘并装进索引，把这一轮合并掉的文件记进 MANIFEST，然后从表里摘掉。
+    // 还拿着引用的读者照样能读，最后一个引用释放时才删文件。MANIFEST 写失败时旧文件原样留着，
+    // 里面的 record 都已经失效，下一轮会把它们直接合并掉
+    std::vector<uint32_t> obsolete;
+    for (uint32_t id : obsolete_)
+    {
+        if (fs::exists(options_.path + std::to_string(id) + suffix))
+            obsolete.push_back(id);
+    }
+    for (Log *log : victims)
+        obsolete.push_back(log->id());
+    if (!manifest_write(options_.path, obsolete))
+    {
+        std::cout << "compact: write manifest failed : " << strerror(errno) << std::endl;
+        return 0;
+    }
+    obsolete_ = std::move(obsolete);
 
-    std::unique_lock lock(this->rwmutex);
-    this->logs.merge(new_logs); // update logs
-
-    for (auto &[key, index] : new_index)
+    uint64_t reclaimed = 0;
+    for (Log *log : victims)
     {
-        if (get_log_id(index.filename) < cur_id)
-            this->index_[key] = index;
+        reclaimed += log->size();
+        log->remove();
+    }
+    for (Log *log : outputs)
+        reclaimed -= std::min<uint64_t>(reclaimed, log->size());
+    size_t merged = victims.size();
+    {
+        std::unique_lock rw_lock(rwmutex);
+        for (uint32_t id : obsolete_)
+            logs.remove(id);
     }
 
-    this->compact_mutex.unlock();
-}
\ No newline at end of file
+    compacted_files_ += merged;
+    reclaimed_bytes_ += reclaimed;
+    std::cout << "compact: merged " << merged << " files into " << outputs.size()
+              << ", reclaimed " << reclaimed << " bytes." << std::endl;
+    return merged;
+}
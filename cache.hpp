@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "record.hpp"
+
+// value 缓存的命中、未命中、淘汰次数和当前占用的字节数
+struct CacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes = 0;
+};
+
+// get 前面的 value 缓存，按 value 在文件里的位置 (file_id, offset) 缓存，不按 key：
+// 文件 id 只增不减、数据文件只追加，同一个位置的内容永远不变，读到一半被 set 覆盖也不会把旧 value 当成新的。
+// key 被覆盖、删除或者被合并挪走以后，旧位置不会再被查到，apply 和合并时把它 erase 掉，不白占空间。
+// 按位置的 hash 分片，每个分片一把锁，用 CLOCK 淘汰，所有分片加起来不超过 capacity 字节
+class ValueCache
+{
+private:
+    // 每个条目除了 value 之外的大致开销：槽和哈希表节点
+    static const size_t kEntryOverhead = 64;
+
+    struct Slot
+    {
+        uint64_t id = 0;
+        std::string value;
+        bool used = false;
+        bool referenced = false;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, size_t> map; // 位置 -> slots 下标
+        std::vector<Slot> slots;
+        std::vector<size_t> free;
+        size_t hand = 0;
+        size_t bytes = 0;
+    };
+
+    size_t shard_count_;
+    size_t shard_capacity_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<uint64_t> hits_{0}, misses_{0}, evictions_{0};
+
+    // 单个数据文件不会超过 1TB，offset 放低 40 位
+    static uint64_t make_id(const ValueIndex &index) { return (uint64_t)index.file_id << 40 | index.offset; }
+    Shard &shard_of(uint64_t id) { return shards_[(id * 0x9e3779b97f4a7c15ULL >> 32) % shard_count_]; }
+
+    void release(Shard &shard, size_t i)
+    {
+        Slot &slot = shard.slots[i];
+        shard.bytes -= slot.value.size() + kEntryOverhead;
+        shard.map.erase(slot.id);
+        slot.used = false;
+        std::string().swap(slot.value);
+        shard.free.push_back(i);
+    }
+
+    // 转动指针直到放得下 need 字节：访问过的清掉标记再给一轮机会，没访问过的淘汰
+    void evict(Shard &shard, size_t need)
+    {
+        while (shard.bytes + need > shard_capacity_ && shard.bytes > 0)
+        {
+            Slot &slot = shard.slots[shard.hand];
+            if (slot.used && slot.referenced)
+                slot.referenced = false;
+            else if (slot.used)
+            {
+                release(shard, shard.hand);
+                evictions_.fetch_add(1, std::memory_order_relaxed);
+            }
+            shard.hand = (shard.hand + 1) % shard.slots.size();
+        }
+    }
+
+public:
+    ValueCache(size_t capacity, size_t shards)
+        : shard_count_(shards ? shards : 1), shard_capacity_(capacity / shard_count_),
+          shards_(new Shard[shard_count_]) {}
+
+    ValueCache(const ValueCache &) = delete;
+    ValueCache &operator=(const ValueCache &) = delete;
+
+    bool lookup(const ValueIndex &index, std::string *value)
+    {
+        uint64_t id = make_id(index);
+        Shard &shard = shard_of(id);
+        {
+            std::lock_guard lock(shard.mutex);
+            auto it = shard.map.find(id);
+            if (it != shard.map.end())
+            {
+                Slot &slot = shard.slots[it->second];
+                slot.referenced = true;
+                *value = slot.value;
+                hits_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // 比一个分片还大的 value 不缓存
+    void insert(const ValueIndex &index, const std::string &value)
+    {
+        size_t charge = value.size() + kEntryOverhead;
+        if (charge > shard_capacity_)
+            return;
+
+        uint64_t id = make_id(index);
+        Shard &shard = shard_of(id);
+        std::lock_guard lock(shard.mutex);
+        if (shard.map.count(id))
+            return;
+
+        evict(shard, charge);
+        size_t i;
+        if (!shard.free.empty())
+        {
+            i = shard.free.back();
+            shard.free.pop_back();
+        }
+        else
+        {
+            i = shard.slots.size();
+            shard.slots.emplace_back();
+        }
+
+        Slot &slot = shard.slots[i];
+        slot.id = id;
+        slot.value = value;
+        slot.used = true;
+        slot.referenced = false;
+        shard.map[id] = i;
+        shard.bytes += charge;
+    }
+
+    void erase(const ValueIndex &index)
+    {
+        uint64_t id = make_id(index);
+        Shard &shard = shard_of(id);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.map.find(id);
+        if (it != shard.map.end())
+            release(shard, it->second);
+    }
+
+    CacheStats stats()
+    {
+        CacheStats stats;
+        stats.hits = hits_.load(std::memory_order_relaxed);
+        stats.misses = misses_.load(std::memory_order_relaxed);
+        stats.evictions = evictions_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < shard_count_; i++)
+        {
+            std::lock_guard lock(shards_[i].mutex);
+            stats.bytes += shards_[i].bytes;
+        }
+        return stats;
+    }
+};
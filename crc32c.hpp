@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "crc32c slicing-by-8 assumes little endian");
+
+// CRC32C（Castagnoli 多项式，反射形式 0x82F63B78）。CPU 支持 SSE4.2 时用 crc32 指令每次处理 8 字节，
+// 否则用 slicing-by-8 查表。第一次调用时检测一次 CPU 特性，之后都走同一个实现。
+const uint32_t kCrc32cPoly = 0x82F63B78;
+
+struct Crc32cTables
+{
+    uint32_t t[8][256];
+
+    // t[k][i]：字节 i 后面再跟 k 个 0 字节的 crc
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (crc & 1 ? kCrc32cPoly : 0);
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            for (int k = 1; k < 8; k++)
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+    }
+};
+
+inline uint32_t crc32c_portable(uint32_t crc, const char *data, size_t n)
+{
+    static const Crc32cTables tables;
+    const auto &t = tables.t;
+    const unsigned char *p = (const unsigned char *)data;
+
+    crc = ~crc;
+    for (; n && ((uintptr_t)p & 7); n--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+              t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    }
+    for (; n; n--)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t crc32c_sse42(uint32_t crc, const char *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t c = ~crc;
+
+    for (; n && ((uintptr_t)p & 7); n--)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    for (; n; n--)
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    return ~(uint32_t)c;
+}
+#endif
+
+using Crc32cFn = uint32_t (*)(uint32_t, const char *, size_t);
+
+inline Crc32cFn crc32c_select()
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32c_sse42;
+#endif
+    return crc32c_portable;
+}
+
+inline bool crc32c_hardware()
+{
+#if defined(__x86_64__)
+    return crc32c_select() == crc32c_sse42;
+#else
+    return false;
+#endif
+}
+
+// 在 crc（上一段数据的结果）基础上继续计算，crc32c_extend(crc32c(a), b) == crc32c(a + b)
+inline uint32_t crc32c_extend(uint32_t crc, const char *data, size_t n)
+{
+    static const Crc32cFn fn = crc32c_select();
+    return fn(crc, data, n);
+}
+
+inline uint32_t crc32c(const char *data, size_t n) { return crc32c_extend(0, data, n); }
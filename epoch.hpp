@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 基于 epoch 的内存回收：读者进入临界区时登记当前 epoch，写者把摘下来的对象
+// 连同当时的 epoch 一起挂起，等所有登记过的读者都走到更新的 epoch 之后再释放。
+class EpochManager
+{
+private:
+    static const size_t kReaderSlots = 128;
+
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<uint64_t> epoch{0}; // 0 表示空闲
+    };
+
+    ReaderSlot readers[kReaderSlots];
+    std::atomic<uint64_t> global{1};
+
+    std::mutex retire_mutex;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+    std::atomic<size_t> retired_count{0};
+
+    uint64_t min_active()
+    {
+        uint64_t min = UINT64_MAX;
+        for (auto &reader : readers)
+        {
+            uint64_t epoch = reader.epoch.load(std::memory_order_seq_cst);
+            if (epoch && epoch < min)
+                min = epoch;
+        }
+        return min;
+    }
+
+public:
+    class Guard
+    {
+    private:
+        ReaderSlot *slot;
+
+    public:
+        explicit Guard(EpochManager &manager)
+        {
+            static thread_local size_t hint = std::hash<std::thread::id>{}(std::this_thread::get_id());
+            for (size_t i = hint;; i++)
+            {
+                ReaderSlot &candidate = manager.readers[i % kReaderSlots];
+                uint64_t expected = 0;
+                if (candidate.epoch.compare_exchange_weak(expected, manager.global.load(),
+                                                          std::memory_order_seq_cst))
+                {
+                    slot = &candidate;
+                    hint = i % kReaderSlots;
+                    return;
+                }
+                if (i - hint >= kReaderSlots)
+                    std::this_thread::yield();
+            }
+        }
+        ~Guard() { slot->epoch.store(0, std::memory_order_release); }
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+    };
+
+    ~EpochManager()
+    {
+        for (auto &[_, deleter] : retired)
+            deleter();
+    }
+
+    // 对象已经从共享结构上摘下之后调用
+    void retire(std::function<void()> deleter)
+    {
+        std::lock_guard lock(retire_mutex);
+        retired.emplace_back(global.fetch_add(1, std::memory_order_seq_cst), std::move(deleter));
+        retired_count.store(retired.size(), std::memory_order_relaxed);
+    }
+
+    // 还没释放的对象个数
+    size_t pending() const { return retired_count.load(std::memory_order_relaxed); }
+
+    void reclaim()
+    {
+        if (!retired_count.load(std::memory_order_relaxed))
+            return;
+
+        std::lock_guard lock(retire_mutex);
+        uint64_t min = min_active();
+        auto iter = retired.begin();
+        while (iter != retired.end())
+        {
+            if (iter->first < min)
+            {
+                iter->second();
+                iter = retired.erase(iter);
+            }
+            else
+                iter++;
+        }
+        retired_count.store(retired.size(), std::memory_order_relaxed);
+    }
+};
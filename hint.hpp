@@ -0,0 +1,126 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "record.hpp"
+
+// hint 文件：和 N.log 一一对应的 N.hint，按写入顺序记录每条 record 的
+// tstamp、key、value 偏移和长度，不含 value。恢复时读它就能重建索引，不用扫数据文件。
+//
+// 条目：| tstamp u64 | key_size u32 | value_size u32 | value_offset u32 | type u8 | key |
+// 结尾：| data_size u64 | crc u32 | magic u32 |，data_size 是生成时数据文件的长度
+const std::string kHintSuffix = ".hint";
+const size_t kHintEntrySize = 8 + 4 + 4 + 4 + 1;
+const size_t kHintFooterSize = 8 + 4 + 4;
+const uint32_t kHintMagic = 0x544e4948; // "HINT"
+
+struct HintEntry
+{
+    uint64_t tstamp;
+    uint32_t value_size;
+    uint32_t value_offset;
+    InfoType type;
+    std::string_view key;
+};
+
+inline uint32_t hint_crc(const char *data, size_t size)
+{
+    return crc32c(data, size);
+}
+
+inline void hint_append(std::string &hints, uint64_t tstamp, std::string_view key,
+                        uint32_t value_offset, uint32_t value_size, InfoType type)
+{
+    char buf[kHintEntrySize];
+    uint32_t key_size = key.size();
+    uint8_t type_byte = type;
+    memcpy(buf, &tstamp, 8);
+    memcpy(buf + 8, &key_size, 4);
+    memcpy(buf + 12, &value_size, 4);
+    memcpy(buf + 16, &value_offset, 4);
+    memcpy(buf + 20, &type_byte, 1);
+    hints.append(buf, kHintEntrySize);
+    hints.append(key.data(), key.size());
+}
+
+// 逐条解析 hint 内容，越界时返回 false
+inline bool hint_next(std::string_view hints, size_t &pos, HintEntry *entry)
+{
+    if (pos + kHintEntrySize > hints.size())
+        return false;
+
+    const char *p = hints.data() + pos;
+    uint32_t key_size;
+    uint8_t type_byte;
+    memcpy(&entry->tstamp, p, 8);
+    memcpy(&key_size, p + 8, 4);
+    memcpy(&entry->value_size, p + 12, 4);
+    memcpy(&entry->value_offset, p + 16, 4);
+    memcpy(&type_byte, p + 20, 1);
+    entry->type = (InfoType)type_byte;
+
+    if (pos + kHintEntrySize + key_size > hints.size())
+        return false;
+    entry->key = std::string_view(p + kHintEntrySize, key_size);
+    pos += kHintEntrySize + key_size;
+    return true;
+}
+
+// 先写临时文件、fsync，再 rename 到位，崩溃时要么没有 hint 要么是完整的 hint
+inline bool hint_write(const std::string &path, const std::string &hints, uint64_t data_size)
+{
+    std::string content = hints;
+    uint32_t crc = hint_crc(hints.data(), hints.size());
+    content.append((const char *)&data_size, 8);
+    content.append((const char *)&crc, 4);
+    content.append((const char *)&kHintMagic, 4);
+
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRWXU);
+    if (fd < 0)
+        return false;
+
+    bool ok = ::write(fd, content.data(), content.size()) == (ssize_t)content.size() && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// 读取并校验 hint，数据文件长度对不上（hint 过期）或者损坏都返回 false
+inline bool hint_load(const std::string &path, uint64_t data_size, std::string *hints)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    bool ok = size >= (off_t)kHintFooterSize;
+    if (ok)
+    {
+        hints->resize(size);
+        ok = pread(fd, hints->data(), size, 0) == size;
+    }
+    close(fd);
+    if (!ok)
+        return false;
+
+    uint64_t recorded_size;
+    uint32_t crc, magic;
+    const char *footer = hints->data() + size - kHintFooterSize;
+    memcpy(&recorded_size, footer, 8);
+    memcpy(&crc, footer + 8, 4);
+    memcpy(&magic, footer + 12, 4);
+    hints->resize(size - kHintFooterSize);
+
+    return magic == kHintMagic && recorded_size == data_size && crc == hint_crc(hints->data(), hints->size());
+}
@@ -0,0 +1,452 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "epoch.hpp"
+#include "record.hpp"
+
+const size_t kArenaChunkSize = 1 << 20;
+// 内联 value 的长度上限：最长的 key 加上内联 value 也能放进一个 arena 块
+const size_t kMaxInlineValueSize = kArenaChunkSize - kMaxKeySize;
+
+// key 的存放区：按 1MB 分块追加。块目录是两级定长数组，块一旦分配地址就不再移动，
+// 读者不加锁也能安全地按偏移访问。
+class KeyArena
+{
+private:
+    static const size_t kDirSize = 1024;
+
+    std::atomic<std::atomic<char *> *> dirs[kDirSize] = {};
+    std::atomic<uint64_t> used{0}; // 下一个可分配的全局偏移
+    size_t chunks = 0;
+
+    char *chunk(size_t i) const
+    {
+        std::atomic<char *> *dir = dirs[i / kDirSize].load(std::memory_order_acquire);
+        return dir ? dir[i % kDirSize].load(std::memory_order_acquire) : nullptr;
+    }
+
+    void add_chunk()
+    {
+        size_t dir_id = chunks / kDirSize;
+        if (!dirs[dir_id].load(std::memory_order_relaxed))
+        {
+            auto dir = new std::atomic<char *>[kDirSize];
+            for (size_t i = 0; i < kDirSize; i++)
+                dir[i].store(nullptr, std::memory_order_relaxed);
+            dirs[dir_id].store(dir, std::memory_order_release);
+        }
+        dirs[dir_id].load(std::memory_order_relaxed)[chunks % kDirSize].store(new char[kArenaChunkSize], std::memory_order_release);
+        chunks++;
+    }
+
+public:
+    KeyArena() {}
+    KeyArena(const KeyArena &) = delete;
+    KeyArena &operator=(const KeyArena &) = delete;
+    ~KeyArena()
+    {
+        for (size_t i = 0; i < chunks; i++)
+            delete[] chunk(i);
+        for (auto &dir : dirs)
+            delete[] dir.load();
+    }
+
+    // 只允许一个写者；value 非空时紧跟在 key 后面写，两者在同一个块里
+    uint64_t append(std::string_view key, std::string_view value = std::string_view())
+    {
+        size_t size = key.size() + value.size();
+        uint64_t ref = used.load(std::memory_order_relaxed);
+        if (ref + size > chunks * kArenaChunkSize)
+        {
+            ref = chunks * kArenaChunkSize;
+            add_chunk();
+        }
+        char *dst = chunk(ref / kArenaChunkSize) + ref % kArenaChunkSize;
+        memcpy(dst, key.data(), key.size());
+        if (!value.empty())
+            memcpy(dst + key.size(), value.data(), value.size());
+        used.store(ref + size, std::memory_order_release);
+        return ref;
+    }
+
+    // 越界（读者拿到了被撕裂的偏移）时返回 nullptr
+    const char *at(uint64_t ref, size_t len) const
+    {
+        if (ref + len > used.load(std::memory_order_acquire) || ref % kArenaChunkSize + len > kArenaChunkSize)
+            return nullptr;
+        const char *base = chunk(ref / kArenaChunkSize);
+        return base ? base + ref % kArenaChunkSize : nullptr;
+    }
+
+    size_t bytes() const { return chunks * kArenaChunkSize; }
+    size_t allocated() const { return used.load(std::memory_order_relaxed); }
+};
+
+// 开放寻址（线性探测）的内存索引。每个槽固定 32 字节：
+// 32 位 hash 指纹、file id、32 位 offset/len、64 位序列号，以及 key 在 arena 中的位置和长度。
+// 小 value 可以内联：value 紧跟在 arena 里的 key 后面，槽里打一个标记，长度就是 len。
+// 删除用 backward shift，不留墓碑；被覆盖或删除的 key 和内联 value 字节在扩容/重建时回收。
+//
+// 写操作（put/erase）需要调用者保证串行；find 不加锁：整张表由一个 seqlock 保护，
+// 读者读到的槽在序号变化时重试，重建时换下来的旧表通过 EpochManager 延迟释放。
+class KeyDir
+{
+private:
+    static const uint64_t kInlineBit = 1ULL << 47;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> meta{0};    // 高 32 位 hash 指纹（0 表示空槽），低 32 位 file id
+        std::atomic<uint64_t> pos{0};     // 高 32 位 offset，低 32 位 len
+        std::atomic<uint64_t> key_ref{0}; // 高 16 位 key 长度，第 47 位内联标记，低 47 位 arena 偏移
+        std::atomic<uint64_t> tstamp{0};  // 这个版本的序列号
+    };
+    static_assert(sizeof(Slot) == 32, "KeyDir slot should stay compact");
+
+    // 槽里内容的一份普通拷贝
+    struct Entry
+    {
+        uint32_t hash = 0;
+        uint32_t file_id;
+        uint32_t offset;
+        uint32_t len;
+        uint64_t key_ref;
+        uint64_t tstamp;
+
+        uint16_t key_len() const { return key_ref >> 48; }
+        uint64_t key_off() const { return key_ref & (kInlineBit - 1); }
+        bool inlined() const { return key_ref & kInlineBit; }
+        // key 和内联 value 在 arena 里占的字节数
+        size_t arena_size() const { return key_len() + (inlined() ? len : 0); }
+        ValueIndex index() const
+        {
+            ValueIndex index(file_id, offset, len, tstamp);
+            index.inlined = inlined();
+            return index;
+        }
+
+        static Entry load(const Slot &slot)
+        {
+            Entry e;
+            uint64_t meta = slot.meta.load(std::memory_order_relaxed);
+            uint64_t pos = slot.pos.load(std::memory_order_relaxed);
+            e.hash = meta >> 32;
+            e.file_id = (uint32_t)meta;
+            e.offset = pos >> 32;
+            e.len = (uint32_t)pos;
+            e.key_ref = slot.key_ref.load(std::memory_order_relaxed);
+            e.tstamp = slot.tstamp.load(std::memory_order_relaxed);
+            return e;
+        }
+
+        void store(Slot &slot) const
+        {
+            slot.meta.store((uint64_t)hash << 32 | file_id, std::memory_order_relaxed);
+            slot.pos.store((uint64_t)offset << 32 | len, std::memory_order_relaxed);
+            slot.key_ref.store(key_ref, std::memory_order_relaxed);
+            slot.tstamp.store(tstamp, std::memory_order_relaxed);
+        }
+    };
+
+    struct Table
+    {
+        std::unique_ptr<Slot[]> slots;
+        size_t mask;
+        KeyArena arena;
+        size_t garbage = 0; // arena 中已经失效的 key 字节数
+
+        explicit Table(size_t capacity) : slots(new Slot[capacity]), mask(capacity - 1) {}
+        size_t capacity() const { return mask + 1; }
+    };
+
+    std::atomic<Table *> table_;
+    std::atomic<uint64_t> seq_{0};
+    std::atomic<uint64_t> rebuilds_{0};
+    size_t count = 0;
+    mutable EpochManager epoch_;
+
+    static uint32_t hash_key(std::string_view key)
+    {
+        uint64_t h = std::hash<std::string_view>{}(key);
+        uint32_t fp = (uint32_t)(h ^ (h >> 32));
+        return fp ? fp : 1;
+    }
+
+    static bool match(const Table *table, const Entry &e, uint32_t hash, std::string_view key)
+    {
+        if (e.hash != hash || e.key_len() != key.size())
+            return false;
+        const char *stored = table->arena.at(e.key_off(), e.key_len());
+        return stored && memcmp(stored, key.data(), key.size()) == 0;
+    }
+
+    // 写者使用：返回 key 所在的槽，不存在时返回它应当插入的空槽
+    static size_t probe(const Table *table, uint32_t hash, std::string_view key)
+    {
+        size_t i = hash & table->mask;
+        for (Entry e = Entry::load(table->slots[i]); e.hash && !match(table, e, hash, key);
+             e = Entry::load(table->slots[i]))
+            i = (i + 1) & table->mask;
+        return i;
+    }
+
+    void begin_write()
+    {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write()
+    {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        epoch_.reclaim();
+    }
+
+    // 在新表里重建，旧表不再修改，等读者离开后释放。新表建好后一次原子 store 发布，
+    // 不需要 seqlock：读者在旧表上读到的内容一直是完整的，重建期间 find 照常进行
+    void rebuild(size_t capacity)
+    {
+        Table *old_table = table_.load(std::memory_order_relaxed);
+        Table *table = new Table(capacity);
+
+        for (size_t i = 0; i < old_table->capacity(); i++)
+        {
+            Entry e = Entry::load(old_table->slots[i]);
+            if (!e.hash)
+                continue;
+            const char *stored = old_table->arena.at(e.key_off(), e.arena_size());
+            std::string_view key(stored, e.key_len());
+            std::string_view value(stored + e.key_len(), e.arena_size() - e.key_len());
+            size_t j = e.hash & table->mask;
+            while (table->slots[j].meta.load(std::memory_order_relaxed))
+                j = (j + 1) & table->mask;
+            e.key_ref = (e.key_ref & ~(kInlineBit - 1)) | table->arena.append(key, value);
+            e.store(table->slots[j]);
+        }
+
+        table_.store(table, std::memory_order_seq_cst);
+        rebuilds_.fetch_add(1, std::memory_order_release);
+        epoch_.retire([old_table]
+                      { delete old_table; });
+    }
+
+public:
+    KeyDir() : table_(new Table(16)) {}
+    // 索引可能有上千万个 key，不允许整体拷贝
+    KeyDir(const KeyDir &) = delete;
+    KeyDir &operator=(const KeyDir &) = delete;
+    ~KeyDir() { delete table_.load(); }
+
+    size_t size() const { return count; }
+    // 槽数组的长度，分段遍历用
+    size_t capacity() const { return table_.load(std::memory_order_acquire)->capacity(); }
+    // 重建（扩容或回收 arena）的次数，重建之后每个 key 所在的槽都变了
+    uint64_t rebuilds() const { return rebuilds_.load(std::memory_order_acquire); }
+
+    // 槽数组加上 arena 实际占用的字节数
+    size_t memory_usage() const
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        return table->capacity() * sizeof(Slot) + table->arena.bytes();
+    }
+
+    // value 内联时顺带拷贝到 value 里（value 不为空的话）
+    bool find(std::string_view key, ValueIndex *index, std::string *value = nullptr) const
+    {
+        uint32_t hash = hash_key(key);
+        EpochManager::Guard guard(epoch_);
+
+        while (true)
+        {
+            uint64_t seq = seq_.load(std::memory_order_acquire);
+            if (seq & 1)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            const Table *table = table_.load(std::memory_order_seq_cst);
+            Entry e;
+            bool found = false;
+            size_t i = hash & table->mask;
+            for (size_t n = 0; n <= table->mask; n++) // 撕裂的读可能看不到空槽，限制探测次数
+            {
+                e = Entry::load(table->slots[i]);
+                if (!e.hash)
+                    break;
+                if (match(table, e, hash, key))
+                {
+                    found = true;
+                    break;
+                }
+                i = (i + 1) & table->mask;
+            }
+
+            // 内联 value 写进 arena 以后不再修改，旧表也要等读者离开才释放，校验完序号再拷贝就行
+            const char *inline_value = found && e.inlined() ? table->arena.at(e.key_off() + e.key_len(), e.len) : nullptr;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) != seq)
+                continue;
+
+            if (found && e.inlined() && !inline_value)
+                continue;
+            if (found && index)
+                *index = e.index();
+            if (found && value && e.inlined())
+                value->assign(inline_value, e.len);
+            return found;
+        }
+    }
+
+    bool contains(std::string_view key) const { return find(key, nullptr); }
+
+    // 插入或覆盖，key 已存在时返回 true 并把旧位置写到 old。
+    // inline_value 不为空时把 index.len 字节的 value 内联存进索引
+    bool put(std::string_view key, const ValueIndex &index, ValueIndex *old = nullptr, const char *inline_value = nullptr)
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        bool grow = (count + 1) * 4 > table->capacity() * 3;
+        if (grow || (table->garbage > kArenaChunkSize && table->garbage * 2 > table->arena.allocated()))
+        {
+            rebuild(grow ? table->capacity() * 2 : table->capacity());
+            table = table_.load(std::memory_order_relaxed);
+        }
+
+        uint32_t hash = hash_key(key);
+        size_t i = probe(table, hash, key);
+        Entry e = Entry::load(table->slots[i]);
+        bool exist = e.hash != 0;
+
+        if (exist && old)
+            *old = e.index();
+        if (!exist)
+        {
+            e.hash = hash;
+            count++;
+        }
+
+        // key 和内联 value 的字节在槽发布之前写好，读者只会经由槽看到它们。
+        // 要内联时 key 跟着新 value 重新追加一份；不内联时原来的 key 接着用，旧的内联 value 作废
+        if (inline_value)
+        {
+            table->garbage += exist ? e.arena_size() : 0;
+            e.key_ref = ((uint64_t)key.size() << 48) | kInlineBit |
+                        table->arena.append(key, std::string_view(inline_value, index.len));
+        }
+        else if (!exist)
+            e.key_ref = ((uint64_t)key.size() << 48) | table->arena.append(key);
+        else if (e.inlined())
+        {
+            table->garbage += e.len;
+            e.key_ref &= ~kInlineBit;
+        }
+        e.file_id = index.file_id;
+        e.offset = index.offset;
+        e.len = index.len;
+        e.tstamp = index.tstamp;
+
+        begin_write();
+        e.store(table->slots[i]);
+        end_write();
+        return exist;
+    }
+
+    // 只改 value 的位置，内联的 value 保留；合并搬动 record 时用，内容不变
+    bool move(std::string_view key, const ValueIndex &index)
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        size_t i = probe(table, hash_key(key), key);
+        Entry e = Entry::load(table->slots[i]);
+        if (!e.hash)
+            return false;
+
+        e.file_id = index.file_id;
+        e.offset = index.offset;
+        e.len = index.len;
+        e.tstamp = index.tstamp;
+        begin_write();
+        e.store(table->slots[i]);
+        end_write();
+        return true;
+    }
+
+    bool erase(std::string_view key, ValueIndex *old = nullptr)
+    {
+        Table *table = table_.load(std::memory_order_relaxed);
+        size_t i = probe(table, hash_key(key), key);
+        Entry e = Entry::load(table->slots[i]);
+        if (!e.hash)
+            return false;
+        if (old)
+            *old = e.index();
+
+        table->garbage += e.arena_size();
+        count--;
+
+        // backward shift：把后面不在自己初始位置上的槽往前挪，填上空洞
+        begin_write();
+        for (size_t j = (i + 1) & table->mask;; j = (j + 1) & table->mask)
+        {
+            Entry next = Entry::load(table->slots[j]);
+            if (!next.hash)
+                break;
+            size_t home = next.hash & table->mask;
+            if (((j - home) & table->mask) >= ((j - i) & table->mask))
+            {
+                next.store(table->slots[i]);
+                i = j;
+            }
+        }
+        table->slots[i].meta.store(0, std::memory_order_relaxed);
+        end_write();
+        return true;
+    }
+
+    // 分段遍历：从第 begin 个槽开始，看过至少 count 个槽以后停在下一个空槽上，返回下一段的起点，
+    // 走到表尾时返回 capacity()。fn 额外拿到内联的 value（没有内联时为空）。
+    // 每一段里调用者要挡住并发的写，两段之间可以有写入：backward shift 只把 key 往它的初始位置挪，
+    // 越不过停下来的那个空槽，所以只要期间没有重建（rebuilds() 不变），一直没被改过的 key 都会被遍历到；
+    // 从表头绕回表尾的 key 可能出现两次
+    template <typename Fn>
+    size_t for_each_from(size_t begin, size_t count, Fn &&fn) const
+    {
+        const Table *table = table_.load(std::memory_order_acquire);
+        size_t i = begin;
+        for (; i < table->capacity(); i++)
+        {
+            Entry e = Entry::load(table->slots[i]);
+            if (!e.hash)
+            {
+                if (i - begin >= count)
+                    break;
+                continue;
+            }
+            const char *stored = table->arena.at(e.key_off(), e.arena_size());
+            fn(std::string_view(stored, e.key_len()), e.index(),
+               std::string_view(stored + e.key_len(), e.arena_size() - e.key_len()));
+        }
+        return i;
+    }
+
+    // 遍历时调用者需要保证没有并发的写
+    template <typename Fn>
+    void for_each(Fn &&fn) const
+    {
+        const Table *table = table_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < table->capacity(); i++)
+        {
+            Entry e = Entry::load(table->slots[i]);
+            if (e.hash)
+                fn(std::string_view(table->arena.at(e.key_off(), e.key_len()), e.key_len()), e.index());
+        }
+    }
+};
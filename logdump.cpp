@@ -0,0 +1,56 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "scanner.hpp"
+
+using namespace std;
+
+// 离线查看数据文件：逐条打印 record 的位置、时间戳、类型、key 和 value 长度，
+// 最后给出条目数、crc 校验不过的条目数以及文件尾部是否完整
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        cout << "usage: logdump <file.log> [-q]" << endl;
+        return 1;
+    }
+    bool quiet = argc > 2 && string(argv[2]) == "-q";
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        cout << "open " << argv[1] << " failed : " << strerror(errno) << endl;
+        return 1;
+    }
+
+    LogScanner scanner(fd, st.st_size);
+    LogEntry entry;
+    size_t records = 0, removes = 0, corrupted = 0;
+    while (scanner.next(&entry))
+    {
+        bool valid = entry.valid();
+        records++;
+        if (entry.type == kRemoveValue)
+            removes++;
+        if (!valid)
+            corrupted++;
+        if (!quiet || !valid)
+            cout << entry.offset << "\ttstamp: " << entry.tstamp
+                 << "\t" << (entry.type == kNewValue ? "set   " : "remove")
+                 << "\tkey: " << entry.key << "\tvalue size: " << entry.value.size()
+                 << (valid ? "" : "\tCHECKSUM MISMATCH") << endl;
+    }
+
+    cout << "records: " << records << "  removes: " << removes << "  corrupted: " << corrupted
+         << "  bytes: " << scanner.offset() << " / " << st.st_size << endl;
+    if (!scanner.finished())
+        cout << "incomplete record at offset " << scanner.offset() << endl;
+    close(fd);
+    return scanner.finished() && !corrupted ? 0 : 2;
+}
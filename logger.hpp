@@ -1,13 +1,28 @@
+#pragma once
+
+#include "epoch.hpp"
+#include "hint.hpp"
 #include "record.hpp"
+#include "slice.h"
+#include "uring.hpp"
+#include "util.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <climits>
 #include <filesystem>
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <iostream>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace fs = std::filesystem;
 
@@ -17,12 +32,15 @@ const std::string DataPath = "data/";
 std::string suffix = ".log";
 std::string prefix = "data/";
 
-size_t get_file_nums()
+size_t get_file_nums(const std::string &dir = DataPath)
 {
     int file_nums = 0;
 
-    for (const auto &entry : fs::directory_iterator(DataPath))
-        file_nums++;
+    for (const auto &entry : fs::directory_iterator(dir))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == suffix)
+            file_nums++;
+    }
 
     return file_nums;
 }
@@ -33,94 +51,551 @@ std::string filename(size_t log_id)
     return fn;
 }
 
-class Log
+// 一个只读映射的数据文件，析构时解除映射
+struct MappedFile
+{
+    char *addr = nullptr;
+    size_t size = 0;
+
+    MappedFile(int fd, size_t size) : size(size)
+    {
+        void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            std::cout << "mmap failed : " << strerror(errno) << std::endl;
+        else
+        {
+            addr = (char *)p;
+            madvise(addr, size, MADV_RANDOM);
+        }
+    }
+    ~MappedFile()
+    {
+        if (addr)
+            munmap(addr, size);
+    }
+};
+
+// 数据文件由 FileTable 和正在用它的读者共同持有，最后一个引用释放时关闭；合并掉的文件这时才删除
+class Log : public std::enable_shared_from_this<Log>
 {
 private:
     ssize_t fd;
     size_t log_size = 0;
+    std::atomic<size_t> unsynced_{0};
     std::string file = "";
+    std::string file_path;
+    uint32_t file_id;
+
+    // seal() 之后文件不再追加，整段映射进内存；mapping_ 只在 sealed_ 置位之前写一次
+    std::shared_ptr<MappedFile> mapping_;
+    std::atomic<bool> sealed_{false};
+
+    std::string hints_; // 还没写成 hint 文件的条目，只有写入者访问
+    bool legacy_ = false; // 没有文件头的老格式文件，只读
+
+    // 合并用的统计：已被覆盖或删除的 record 字节数、文件里最小的 tstamp
+    std::atomic<uint64_t> dead_bytes_{0};
+    std::atomic<uint64_t> min_tstamp_{UINT64_MAX};
+    uint64_t tstamp_base_ = 0; // 老格式文件第一条 record 重新编的序列号
+    std::atomic<bool> removed_{false}; // 已经合并掉，文件被删除
+
+    bool read_at(uint64_t offset, char *buf, size_t len);
+    void writev_all(struct iovec *iovs, size_t count);
+    size_t head_size(size_t key_size, size_t value_size)
+    {
+        return legacy_ ? kLegacyHeadSize : record_head_size(key_size, value_size);
+    }
+    size_t value_crc_offset() { return legacy_ ? kLegacyValueCrcOffset : kRecValueCrcOffset; }
 
 public:
-    Log(const std::string &filename) : file(filename)
+    Log(const std::string &filename, const std::string &dir = DataPath)
+        : file(filename), file_path(dir + filename), file_id(get_log_id(filename))
     {
-        std::string temp = std::string(DataPath + filename);
-        fd = open(temp.c_str(), O_APPEND | O_SYNC | O_CREAT | O_RDWR, S_IRWXU);
+        fd = open(file_path.c_str(), O_APPEND | O_CREAT | O_RDWR, S_IRWXU);
 
         log_size = lseek(fd, 0, SEEK_END);
         if (fd < 0)
             std::cout << strerror(errno) << std::endl;
+        else if (log_size == 0)
+        {
+            // 新文件先写文件头
+            char header[kFileHeaderSize] = {};
+            memcpy(header, &kFileMagic, sizeof(kFileMagic));
+            header[sizeof(kFileMagic)] = kFormatVersion;
+            if (::write(fd, header, kFileHeaderSize) != (ssize_t)kFileHeaderSize)
+            {
+                std::cout << "logger write file header failed at id : " << file << std::endl
+                          << strerror(errno) << std::endl;
+                exit(-1);
+            }
+            log_size = kFileHeaderSize;
+        }
+        else
+        {
+            uint32_t magic = 0;
+            legacy_ = ::pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) || magic != kFileMagic;
+        }
+    }
+    ~Log()
+    {
+        close(fd);
+        if (removed())
+        {
+            unlink(file_path.c_str());
+            unlink(hint_path().c_str());
+        }
     }
-    ~Log() { close(fd); }
 
-    size_t write(Record &record, size_t record_size);
-    bool read(ValueIndex &target, char *str);
+    void write_batch(const std::vector<Record *> &records, std::vector<size_t> &value_offsets,
+                     IoUring *ring = nullptr, bool sync = false);
+    void append(const char *data, size_t size);
+    void sync();
+    bool read(const ValueIndex &target, char *str);
+    bool read(const ValueIndex &target, Slice *slice);
+    bool read_verified(const ValueIndex &target, size_t key_size, char *str, bool *valid);
+    bool verify(const ValueIndex &target, size_t key_size, const char *value);
+    bool truncate(size_t size);
+    void seal();
+
+    void add_hint(uint64_t tstamp, std::string_view key, uint32_t value_offset, uint32_t value_size, InfoType type)
+    {
+        hint_append(hints_, tstamp, key, value_offset, value_size, type);
+        note_tstamp(tstamp);
+    }
+    bool write_hint();
+    const std::string &pending_hints() { return hints_; }
+    void restore_hints(const std::string &hints) { hints_ = hints; }
+    std::string hint_path() { return file_path.substr(0, file_path.size() - suffix.size()) + kHintSuffix; }
+    bool sealed() { return sealed_.load(std::memory_order_acquire); }
+    bool legacy() { return legacy_; }
 
     size_t size() { return log_size; }
-    size_t get_fd() { return fd; }
+    // 文件头之后的数据长度
+    size_t data_size() { return log_size - (legacy_ ? 0 : kFileHeaderSize); }
+    // 这个文件里一条 record 占的字节数
+    size_t record_bytes(size_t key_size, size_t value_size)
+    {
+        return legacy_ ? legacy_record_size(key_size, value_size) : record_size(key_size, value_size);
+    }
+
+    void add_dead(uint64_t bytes) { dead_bytes_.fetch_add(bytes, std::memory_order_relaxed); }
+    uint64_t dead_bytes() { return dead_bytes_.load(std::memory_order_relaxed); }
+    // 失效字节占数据的比例，合并时优先挑比例高的文件
+    double garbage_ratio()
+    {
+        size_t data = data_size();
+        return data ? std::min(1.0, (double)dead_bytes() / data) : 0;
+    }
+    void note_tstamp(uint64_t tstamp)
+    {
+        uint64_t cur = min_tstamp_.load(std::memory_order_relaxed);
+        while (tstamp < cur && !min_tstamp_.compare_exchange_weak(cur, tstamp, std::memory_order_relaxed))
+            ;
+    }
+    uint64_t min_tstamp() { return min_tstamp_.load(std::memory_order_relaxed); }
+    // 老格式 record 里的 tstamp 没法和新格式的序列号比，恢复时按 (文件 id, 文件内位置) 重新编号，
+    // 这个文件的第 i 条 record 的序列号是 base + i
+    void rebase_tstamps(uint64_t base, size_t records)
+    {
+        tstamp_base_ = base;
+        min_tstamp_.store(records ? base : UINT64_MAX, std::memory_order_relaxed);
+    }
+    uint64_t tstamp_base() { return tstamp_base_; }
+    void remove();
+    bool removed() { return removed_.load(std::memory_order_acquire); }
+    size_t unsynced() { return unsynced_.load(); }
+    int get_fd() { return fd; }
     std::string get_fn() { return file; }
+    const std::string &path() { return file_path; }
+    uint32_t id() { return file_id; }
 };
 
-size_t Log::write(Record &record, size_t record_size)
+using LogRef = std::shared_ptr<Log>;
+
+// file id -> Log 的稠密表，解析文件就是一次下标访问；空位是 nullptr。
+// get 不加锁读取：扩容时换一个更大的数组，旧数组留到析构才释放；add、remove 需要调用者串行。
+// 表对每个 Log 持有一个引用，remove 时摘掉，等并发的 acquire 都结束后再放掉这个引用
+class FileTable
+{
+private:
+    std::vector<std::unique_ptr<std::atomic<Log *>[]>> arrays;
+    std::atomic<std::atomic<Log *> *> files{nullptr};
+    std::atomic<size_t> capacity{0};
+    std::unordered_map<uint32_t, LogRef> owners;
+    mutable EpochManager epoch_;
+
+public:
+    FileTable() {}
+    FileTable(const FileTable &) = delete;
+    FileTable &operator=(const FileTable &) = delete;
+
+    // 裸指针只在调用者能排除并发 remove 时使用，比如和 remove 用同一把锁串行，或者恢复期间
+    Log *get(uint32_t id) const
+    {
+        // 先读 capacity 再读数组，拿到的数组至少和 capacity 一样新
+        if (id >= capacity.load(std::memory_order_acquire))
+            return nullptr;
+        return files.load(std::memory_order_acquire)[id].load(std::memory_order_acquire);
+    }
+
+    // 不加锁地拿到一个引用，文件已经被合并掉时返回 nullptr
+    LogRef acquire(uint32_t id) const
+    {
+        EpochManager::Guard guard(epoch_);
+        Log *log = get(id);
+        return log ? log->shared_from_this() : nullptr;
+    }
+
+    // 表里全部文件的引用
+    std::vector<LogRef> snapshot() const
+    {
+        EpochManager::Guard guard(epoch_);
+        std::vector<LogRef> refs;
+        for_each([&](Log *log)
+                 { refs.push_back(log->shared_from_this()); });
+        return refs;
+    }
+
+    // 表接管 log 的所有权
+    void add(Log *log)
+    {
+        size_t cap = capacity.load(std::memory_order_relaxed);
+        if (log->id() >= cap)
+        {
+            size_t new_cap = std::max<size_t>(cap * 2, log->id() + 1);
+            std::unique_ptr<std::atomic<Log *>[]> array(new std::atomic<Log *>[new_cap]);
+            for (size_t i = 0; i < new_cap; i++)
+                array[i].store(i < cap ? get(i) : nullptr, std::memory_order_relaxed);
+
+            files.store(array.get(), std::memory_order_release);
+            capacity.store(new_cap, std::memory_order_release);
+            arrays.push_back(std::move(array));
+        }
+        owners[log->id()] = LogRef(log);
+        files.load(std::memory_order_relaxed)[log->id()].store(log, std::memory_order_release);
+    }
+
+    void remove(uint32_t id)
+    {
+        auto iter = owners.find(id);
+        if (iter == owners.end())
+            return;
+        files.load(std::memory_order_relaxed)[id].store(nullptr, std::memory_order_release);
+        epoch_.retire([ref = std::move(iter->second)]() mutable
+                      { ref.reset(); });
+        owners.erase(iter);
+        epoch_.reclaim();
+    }
+
+    // 释放读者已经离开的、被 remove 摘下的文件引用。remove 时还有读者在的话，
+    // 文件要等到下一次调用才关闭、删除，合并线程每次醒来都会调用
+    void reclaim() { epoch_.reclaim(); }
+    // 已经摘下、还没释放的文件个数
+    size_t retired() const { return epoch_.pending(); }
+
+    template <typename Fn>
+    void for_each(Fn &&fn) const
+    {
+        size_t cap = capacity.load(std::memory_order_acquire);
+        for (size_t i = 0; i < cap; i++)
+        {
+            if (Log *log = get(i))
+                fn(log);
+        }
+    }
+};
+
+// writev 一次最多 IOV_MAX 段，短写时从断点继续；失败时直接退出
+void Log::writev_all(struct iovec *iovs, size_t count)
+{
+    size_t done = 0;
+    while (done < count)
+    {
+        ssize_t write_nums = ::writev(fd, &iovs[done], std::min<size_t>(count - done, IOV_MAX));
+        if (write_nums < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::cout << "logger writev failed at id : " << file << std::endl
+                      << strerror(errno) << std::endl;
+            exit(-1);
+        }
+
+        log_size += write_nums;
+        unsynced_ += write_nums;
+        while (done < count && (size_t)write_nums >= iovs[done].iov_len)
+            write_nums -= iovs[done++].iov_len;
+        if (write_nums > 0)
+        {
+            iovs[done].iov_base = (char *)iovs[done].iov_base + write_nums;
+            iovs[done].iov_len -= write_nums;
+        }
+    }
+}
+
+// 一次 writev 写入整组 record，返回每条 record 的 value 偏移；sync 为 true 时顺带刷盘。
+// 给了 io_uring 时 writev 和 fdatasync 链在一起，一次 io_uring_enter 提交
+void Log::write_batch(const std::vector<Record *> &records, std::vector<size_t> &value_offsets,
+                      IoUring *ring, bool sync)
 {
-    char *temp = new char[record_size];
-    record.build_buffer(temp);
-    size_t write_nums;
+    if (fd < 0)
+    {
+        std::cout << "logger open file failed at id : " << file << std::endl
+                  << strerror(errno) << std::endl;
+        exit(-1);
+    }
+
+    // 每条 record 最多三段：Record 里编码好的头部、调用者的 key 和 value，空的 value 不占 iovec
+    std::vector<struct iovec> iovs;
+    iovs.reserve(records.size() * 3);
+    value_offsets.clear();
+
+    size_t offset = log_size;
+    for (auto record : records)
+    {
+        record->build_head();
+        iovs.push_back({record->head, record->head_len});
+        iovs.push_back({(void *)record->key.data(), record->key_size});
+        if (record->value_size)
+            iovs.push_back({(void *)record->value.data(), record->value_size});
+
+        value_offsets.push_back(offset + record->head_len + record->key_size);
+        add_hint(record->time_stamp, record->key, value_offsets.back(), record->value_size, record->value_type);
+        offset += record->head_len + record->key_size + record->value_size;
+    }
+
+    size_t done = 0;
+    if (ring && ring->ok() && iovs.size() <= IOV_MAX)
+    {
+        size_t total = offset - log_size;
+        io_uring_sqe *sqe = ring->get_sqe();
+        IoUring::prep_rw(sqe, IORING_OP_WRITEV, fd, iovs.data(), iovs.size(), log_size, 0);
+        if (sync)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+            sqe = ring->get_sqe();
+            IoUring::prep_rw(sqe, IORING_OP_FSYNC, fd, nullptr, 0, 0, 1);
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
 
+        int results[2] = {0, 0};
+        int expect = sync ? 2 : 1;
+        for (int reaped = 0, wait_nr = expect; reaped < expect;)
+        {
+            io_uring_cqe *cqe = ring->peek();
+            if (!cqe)
+            {
+                if (ring->submit(wait_nr) < 0)
+                {
+                    std::cout << "logger io_uring_enter failed at id : " << file << std::endl
+                              << strerror(errno) << std::endl;
+                    exit(-1);
+                }
+                wait_nr = 1;
+                continue;
+            }
+            results[cqe->user_data] = cqe->res;
+            ring->seen();
+            reaped++;
+        }
+
+        if (results[0] > 0)
+        {
+            log_size += results[0];
+            unsynced_ += results[0];
+        }
+        if (results[0] == (int)total && (!sync || results[1] == 0))
+        {
+            if (sync)
+                unsynced_ = 0;
+            return;
+        }
+        // 写全了但刷盘出错：数据可能没落盘，不能再向写入者确认；-EINVAL 是内核不支持，走同步路径重试
+        if (sync && results[0] == (int)total && results[1] != -EINVAL)
+        {
+            std::cout << "logger fdatasync failed at id : " << file << std::endl
+                      << strerror(-results[1]) << std::endl;
+            exit(-1);
+        }
+
+        // 短写或者内核不支持，剩下的部分走同步路径
+        ssize_t write_nums = std::max(results[0], 0);
+        while (done < iovs.size() && (size_t)write_nums >= iovs[done].iov_len)
+            write_nums -= iovs[done++].iov_len;
+        if (write_nums > 0)
+        {
+            iovs[done].iov_base = (char *)iovs[done].iov_base + write_nums;
+            iovs[done].iov_len -= write_nums;
+        }
+    }
+
+    if (done < iovs.size())
+        writev_all(&iovs[done], iovs.size() - done);
+
+    if (sync)
+        this->sync();
+}
+
+// 追加已经编码好的 record，不刷盘；合并时整块写入原样拷贝的 record，hint 由调用者添加
+void Log::append(const char *data, size_t size)
+{
     if (fd < 0)
     {
         std::cout << "logger open file failed at id : " << file << std::endl
                   << strerror(errno) << std::endl;
         exit(-1);
     }
+    struct iovec iov = {(void *)data, size};
+    writev_all(&iov, 1);
+}
 
-    size_t offset = lseek(fd, 0, SEEK_CUR);
-    if (offset < 0)
+// 刷盘失败时数据可能没落盘，和写失败一样直接退出，不向写入者确认
+void Log::sync()
+{
+    size_t pending = unsynced_.load();
+    if (fdatasync(fd) != 0)
     {
-        std::cout << "logger lseek failed at id : " << file << std::endl
+        std::cout << "logger fdatasync failed at id : " << file << std::endl
                   << strerror(errno) << std::endl;
         exit(-1);
     }
+    unsynced_ -= pending;
+}
 
-    // std::lock_guard<std::mutex> lock(mutex_RW);
+// 只读文件直接从映射里拷贝，活跃文件用一次 pread
+bool Log::read_at(uint64_t offset, char *buf, size_t len)
+{
+    if (sealed() && mapping_->addr && offset + len <= mapping_->size)
     {
-        write_nums = ::write(fd, (void *)temp, record_size);
+        memcpy(buf, mapping_->addr + offset, len);
+        return true;
     }
+    return ::pread(fd, buf, len, offset) == (ssize_t)len;
+}
 
-    if (write_nums == record_size)
+bool Log::read(const ValueIndex &target, char *str)
+{
+    if (!read_at(target.offset, str, target.len))
     {
-        fsync(fd);
-        log_size += record_size;
+        std::cout << "logger pread failed at id : " << file << std::endl
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
 
-        std::thread::id this_id = std::this_thread::get_id();
+// 读 value 的同时取出头部里的 value_crc 校验，活跃文件用一次 preadv 把两者一起读出来；
+// 读失败返回 false，校验结果放在 valid 里
+bool Log::read_verified(const ValueIndex &target, size_t key_size, char *str, bool *valid)
+{
+    size_t head = head_size(key_size, target.len);
+    if (target.offset < key_size + head)
+        return false;
+    uint64_t start = (uint64_t)target.offset - key_size - head;
+    uint32_t value_crc;
 
-        // std::cout << "Thread id: " << this_id << "  Successfully write: "
-        //           << '"' << record.value << '"' << "  file id :" << file << std::endl;
+    if (sealed() && mapping_->addr && target.offset + target.len <= mapping_->size)
+    {
+        memcpy(str, mapping_->addr + target.offset, target.len);
+        memcpy(&value_crc, mapping_->addr + start + value_crc_offset(), kCRCSize);
     }
     else
     {
-        std::cout << "logger write failed at id : " << file << std::endl
-                  << strerror(errno) << std::endl;
-        exit(-1);
-    }
+        // value_crc 到 key 结尾这一段和 value 在文件里是连续的
+        size_t head_len = head - value_crc_offset() + key_size;
+        char small[256];
+        std::unique_ptr<char[]> large(head_len > sizeof(small) ? new char[head_len] : nullptr);
+        char *buf = large ? large.get() : small;
 
-    delete[] temp;
+        struct iovec iov[2] = {{buf, head_len}, {str, target.len}};
+        if (::preadv(fd, iov, 2, start + value_crc_offset()) != (ssize_t)(head_len + target.len))
+        {
+            std::cout << "logger preadv failed at id : " << file << std::endl
+                      << strerror(errno) << std::endl;
+            return false;
+        }
+        memcpy(&value_crc, buf, kCRCSize);
+    }
 
-    return offset + record_size - kValueTypeSize - record.value_size;
+    *valid = value_crc == crc32c(str, target.len) || (legacy_ && verify(target, key_size, str));
+    return true;
 }
 
-bool Log::read(ValueIndex &target, char *str)
+// 校验读出来的 value，只需要再读头部里 4 字节的 value_crc；老格式文件里对不上时
+// 可能是加 value_crc 之前的 record，读出整条 record 按老的 crc 校验
+bool Log::verify(const ValueIndex &target, size_t key_size, const char *value)
 {
-    size_t lseek_offset = lseek(fd, target.offset, SEEK_SET);
+    size_t head = head_size(key_size, target.len);
+    uint64_t start = (uint64_t)target.offset - key_size - head;
+    uint32_t value_crc;
+    if (target.offset < key_size + head || !read_at(start + value_crc_offset(), (char *)&value_crc, kCRCSize))
+        return false;
+    if (value_crc == crc32c(value, target.len))
+        return true;
+    if (!legacy_)
+        return false;
+
+    size_t size = legacy_record_size(key_size, target.len);
+    std::unique_ptr<char[]> record(new char[size]);
+    return read_at(start, record.get(), size) &&
+           legacy_record_valid(record.get(), key_size, target.len) &&
+           memcmp(record.get() + kLegacyHeadSize + key_size, value, target.len) == 0;
+}
 
-    if (lseek_offset == target.offset)
+// 只读文件返回指向映射的零拷贝视图，活跃文件读到一块新分配的内存里
+bool Log::read(const ValueIndex &target, Slice *slice)
+{
+    if (sealed() && mapping_->addr && target.offset + target.len <= mapping_->size)
     {
-        ::pread(fd, str, target.len, target.offset);
+        *slice = Slice(mapping_, std::string_view(mapping_->addr + target.offset, target.len));
         return true;
     }
-    else
+
+    std::shared_ptr<char[]> buffer(new char[target.len]);
+    if (!read(target, buffer.get()))
+        return false;
+    *slice = Slice(buffer, std::string_view(buffer.get(), target.len));
+    return true;
+}
+
+// 文件写完以后调用：数据先落盘，再把攒下的条目写成 hint 文件
+bool Log::write_hint()
+{
+    if (fdatasync(fd) != 0 || !hint_write(hint_path(), hints_, log_size))
     {
-        std::cout << "lseek error" << std::endl
+        std::cout << "write hint failed at id : " << file << std::endl
                   << strerror(errno) << std::endl;
+        return false;
     }
-    return false;
+    unsynced_ = 0;
+    std::string().swap(hints_);
+    return true;
+}
+
+// 恢复时发现 size 之后的内容不完整或者校验不过，把它们截掉
+bool Log::truncate(size_t size)
+{
+    if (ftruncate(fd, size) != 0 || fdatasync(fd) != 0)
+    {
+        std::cout << "logger truncate failed at id : " << file << std::endl
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    log_size = size;
+    return true;
+}
+
+// 合并提交后标记为已删除，数据文件和 hint 在析构时删掉，之前拿到引用的读者照样能读
+void Log::remove()
+{
+    removed_.store(true, std::memory_order_release);
+}
+
+// 文件切换出去以后调用，之后这个文件只读
+void Log::seal()
+{
+    if (sealed() || log_size == 0)
+        return;
+    mapping_ = std::make_shared<MappedFile>(fd, log_size);
+    sealed_.store(true, std::memory_order_release);
 }
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "crc32c.hpp"
+
+// MANIFEST：合并的提交记录，列出已经被合并掉、文件可能还没删的数据文件 id。
+// 合并先把输出文件落盘、装进索引，再写 MANIFEST；rename 到位并刷了目录就算提交，
+// 之后旧文件什么时候删都可以。恢复时先删掉这里列出的文件，再加载剩下的，
+// 不会出现一轮合并的旧文件只删了一部分的情况。
+//
+// 内容：| count u32 | id u32 * count | crc u32 | magic u32 |
+const std::string kManifestName = "MANIFEST";
+const uint32_t kManifestMagic = 0x5446494d; // "MIFT"
+
+// 刷目录，让 rename 和新建的文件名落盘
+inline bool sync_dir(const std::string &dir)
+{
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+inline bool manifest_write(const std::string &dir, const std::vector<uint32_t> &obsolete)
+{
+    std::string content;
+    uint32_t count = obsolete.size();
+    content.append((const char *)&count, 4);
+    content.append((const char *)obsolete.data(), obsolete.size() * 4);
+    uint32_t crc = crc32c(content.data(), content.size());
+    content.append((const char *)&crc, 4);
+    content.append((const char *)&kManifestMagic, 4);
+
+    std::string path = dir + kManifestName, tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_CREAT | O_TRUNC | O_WRONLY, S_IRWXU);
+    if (fd < 0)
+        return false;
+
+    bool ok = ::write(fd, content.data(), content.size()) == (ssize_t)content.size() && fdatasync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return sync_dir(dir);
+}
+
+// 没有 MANIFEST 时返回空列表；内容损坏返回 false
+inline bool manifest_load(const std::string &dir, std::vector<uint32_t> *obsolete)
+{
+    obsolete->clear();
+    int fd = open((dir + kManifestName).c_str(), O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT;
+
+    std::string content;
+    off_t size = lseek(fd, 0, SEEK_END);
+    bool ok = size >= 12;
+    if (ok)
+    {
+        content.resize(size);
+        ok = pread(fd, content.data(), size, 0) == size;
+    }
+    close(fd);
+    if (!ok)
+        return false;
+
+    uint32_t count, crc, magic;
+    memcpy(&count, content.data(), 4);
+    if ((size_t)size != 12 + (size_t)count * 4)
+        return false;
+    memcpy(&crc, content.data() + size - 8, 4);
+    memcpy(&magic, content.data() + size - 4, 4);
+    if (magic != kManifestMagic || crc != crc32c(content.data(), size - 8))
+        return false;
+
+    obsolete->resize(count);
+    memcpy(obsolete->data(), content.data() + 4, count * 4);
+    return true;
+}
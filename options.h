@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "record.hpp"
+
+enum SyncMode
+{
+    kSyncAlways,   // 每次组提交后 fdatasync，崩溃不丢已返回的写入
+    kSyncInterval, // 后台线程按时间间隔或未刷盘字节数刷盘
+    kSyncNone,     // 不主动刷盘，交给操作系统回写
+};
+
+struct Options
+{
+    std::string path = "data/"; // 数据目录，以 '/' 结尾
+    size_t max_log_size = kLogSize; // 数据文件超过这个长度后切换，不超过 kMaxLogSize
+
+    // 后台合并：失效字节占比达到 compact_garbage_ratio 的只读文件才是候选，每轮按比例从高到低
+    // 最多合并 compact_max_files 个；选中文件的失效字节合计不到 compact_threshold 时不合并。
+    // 新产生的失效字节累计到 compact_threshold 时立即唤醒合并线程，否则每隔 compact_interval_ms 检查一次，
+    // compact_interval_ms 为 0 时只在被唤醒时检查
+    uint64_t compact_threshold = kCompactThreshold;
+    double compact_garbage_ratio = 0.5;
+    size_t compact_max_files = 8;
+    uint64_t compact_interval_ms = 1000;
+    // 合并读写的限速，字节/秒，0 表示不限速
+    uint64_t compact_rate_bytes = 0;
+    // 只在本地时间 [begin, end) 点之间开始合并，begin > end 表示跨零点，两者相等表示不合并
+    int compact_window_begin = 0;
+    int compact_window_end = 24;
+
+    // 切换出去的只读数据文件整段 mmap，读它们不再走 pread
+    bool mmap_sealed = true;
+
+    // 组提交和 get_async 使用 io_uring，内核不支持时自动退回同步系统调用
+    bool use_io_uring = true;
+    unsigned io_depth = 64;
+
+    // 恢复时并行加载数据文件的线程数，0 表示用全部核
+    size_t recovery_threads = 0;
+
+    // 恢复时扫描数据文件逐条校验 crc，在第一条坏 record 处截断文件；关掉只检查长度
+    bool verify_recovery = true;
+    // get 时用 value_crc 校验读出来的 value，不一致返回 Corrupted
+    bool verify_reads = false;
+    // 后台校验线程每隔多久把所有只读文件完整扫一遍，0 表示不启动
+    uint64_t scrub_interval_ms = 0;
+
+    // 不超过这个长度的 value 除了写进文件，还内联存进内存索引，get 直接从索引里拷贝，0 表示不内联。
+    // key 和 value 要放进索引 arena 的同一个块里，超过 kMaxInlineValueSize 时按它算
+    size_t inline_value_size = 0;
+
+    // get 前面的 value 缓存，按字节计的容量，0 表示不缓存；cache_shards 是缓存的分片数
+    size_t cache_bytes = 0;
+    size_t cache_shards = 16;
+
+    // ShardedBitcask 的分区数，每个分区是 path 下的一个子目录
+    size_t shards = 1;
+
+    SyncMode sync_mode = kSyncAlways;
+
+    // kSyncInterval 下两个条件满足其一就刷盘，sync_interval_ms 为 0 时只看未刷盘字节数
+    uint64_t sync_interval_ms = 100;
+    size_t sync_bytes = 1 << 20;
+};
@@ -1,5 +1,9 @@
+#pragma once
+
 #include "crc32.h"
+#include "crc32c.hpp"
 #include <cstring>
+#include <string>
 enum InfoType
 {
     kNewValue = '0',
@@ -14,12 +18,22 @@ const uint64_t kRecordSize = sizeof(uint64_t);
 const uint64_t kValueTypeSize = sizeof(InfoType);
 const uint64_t kCompactThreshold = 1 << 9;
 const size_t kLogSize = 1 << 8;
+const size_t kMaxBatchSize = 1 << 20;
+const size_t kMaxKeySize = (1 << 16) - 1;
+// ValueIndex、索引槽和 hint 里的 offset、len 都是 32 位。一次写入（一条 set 或者一个 WriteBatch）编码后
+// 不超过 kMaxWriteSize，文件长度超过 max_log_size 才切换，max_log_size 不超过 kMaxLogSize，
+// 这样 offset + len 总能放进 32 位
+const uint64_t kMaxWriteSize = 1ULL << 31;
+const uint64_t kMaxLogSize = UINT32_MAX - kMaxWriteSize;
 
 struct ValueIndex
 {
-    std::string filename;
-    uint64_t offset, len;
-    ValueIndex(std::string filename, uint64_t offset, uint64_t len) : filename(filename), offset(offset), len(len) {}
+    uint32_t file_id = 0;
+    uint32_t offset = 0, len = 0;
+    uint64_t tstamp = 0; // 写入这个版本时分配的序列号，和 record 里的 tstamp 一致
+    bool inlined = false; // value 同时存在内存索引里（KeyDir 的内联小 value）
+    ValueIndex(uint32_t file_id, uint32_t offset, uint32_t len, uint64_t tstamp = 0)
+        : file_id(file_id), offset(offset), len(len), tstamp(tstamp) {}
     ValueIndex() {}
     ~ValueIndex() {}
 };
@@ -31,39 +45,164 @@ struct InfoHeader
     uint64_t key_size;
     uint64_t value_size;
 
-    virtual void build_buffer(char *temp) = 0;
-
     InfoHeader() {}
     InfoHeader(uint64_t tstamp, uint64_t key_size, uint64_t value_size)
-        : time_stamp(tstamp), key_size(key_size), value_size(value_size)
-    {
-        crc = CRC::Calculate(&time_stamp, kTimeStampSize, CRC::CRC_32());
-        crc = CRC::Calculate(&key_size, kKeyLenSize, CRC::CRC_32(), crc);
-        crc = CRC::Calculate(&value_size, kValueLenSize, CRC::CRC_32(), crc);
-    }
+        : time_stamp(tstamp), key_size(key_size), value_size(value_size) {}
     ~InfoHeader() {}
 };
-const size_t kInfoHeadSize = sizeof(InfoHeader);
+
+// 新数据文件以 8 字节的文件头开始：| magic u32 | version u8 | 保留 3 字节 |。
+// 没有文件头的是老格式文件，只读不追加，合并时被改写成新格式。
+const uint32_t kFileMagic = 0x4b534342; // "BCSK"
+const uint8_t kFormatVersion = 1;
+const size_t kFileHeaderSize = 8;
+
+// 新格式的 record，所有字段按小端逐字节编码，和编译器、进程无关：
+// | magic u8 | crc u32 | value_crc u32 | tstamp u64 | type u8 | key_size varint | value_size varint | key | value |
+// magic 同时是格式版本号。value_crc 是 value 的 CRC32C；crc 覆盖从 value_crc 到 key 结尾的连续字节，
+// value 经由 value_crc 间接覆盖，写入时 value 只需要算一遍。
+const uint8_t kRecordMagic = 0xB1;
+const size_t kRecCrcOffset = 1;
+const size_t kRecValueCrcOffset = 5;
+const size_t kRecTstampOffset = 9;
+const size_t kRecTypeOffset = 17;
+const size_t kRecFixedSize = 18;
+const size_t kMaxVarintSize = 10;
+const size_t kMaxRecordHeadSize = kRecFixedSize + 2 * kMaxVarintSize;
+
+inline size_t varint_size(uint64_t v)
+{
+    size_t n = 1;
+    for (; v >= 0x80; v >>= 7)
+        n++;
+    return n;
+}
+
+inline char *put_varint(char *p, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        *p++ = (char)(v | 0x80);
+    *p++ = (char)v;
+    return p;
+}
+
+// 解析失败（越过 end 或者超过 10 字节）返回 nullptr
+inline const char *get_varint(const char *p, const char *end, uint64_t *v)
+{
+    uint64_t result = 0;
+    for (size_t shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *v = result;
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+inline size_t record_head_size(uint64_t key_size, uint64_t value_size)
+{
+    return kRecFixedSize + varint_size(key_size) + varint_size(value_size);
+}
+
+inline size_t record_size(uint64_t key_size, uint64_t value_size)
+{
+    return record_head_size(key_size, value_size) + key_size + value_size;
+}
+
+// 写出除 crc 以外的头部，返回头部长度
+inline size_t encode_head(char *head, uint64_t tstamp, InfoType type, uint64_t key_size, uint64_t value_size, uint32_t value_crc)
+{
+    head[0] = (char)kRecordMagic;
+    memset(head + kRecCrcOffset, 0, kCRCSize);
+    memcpy(head + kRecValueCrcOffset, &value_crc, kCRCSize);
+    memcpy(head + kRecTstampOffset, &tstamp, kTimeStampSize);
+    head[kRecTypeOffset] = (char)type;
+    char *p = put_varint(head + kRecFixedSize, key_size);
+    return put_varint(p, value_size) - head;
+}
+
+// head 后面不一定紧跟着 key，分两段算
+inline uint32_t record_crc(const char *head, size_t head_size, const char *key, size_t key_size)
+{
+    uint32_t crc = crc32c(head + kRecValueCrcOffset, head_size - kRecValueCrcOffset);
+    return crc32c_extend(crc, key, key_size);
+}
+
+inline bool record_valid(const char *record, size_t head_size, uint64_t key_size, uint64_t value_size)
+{
+    uint32_t crc, value_crc;
+    memcpy(&crc, record + kRecCrcOffset, kCRCSize);
+    memcpy(&value_crc, record + kRecValueCrcOffset, kCRCSize);
+    return (uint8_t)record[0] == kRecordMagic &&
+           crc == record_crc(record, head_size, record + head_size, key_size) &&
+           value_crc == crc32c(record + head_size + key_size, value_size);
+}
+
+// 老格式文件里的 record：头部是当初带虚表指针的 InfoHeader 的内存拷贝，type 在结尾占 4 字节
+// | vptr 8 | crc u32 | value_crc u32 | tstamp u64 | key_size u64 | value_size u64 | key | value | type |
+// 最早的 record 没有 value_crc，crc 是 tstamp 到 type 逐字段的 CRC_32，正好是一段连续字节
+const size_t kLegacyHeadSize = 40;
+const size_t kLegacyCrcOffset = 8;
+const size_t kLegacyValueCrcOffset = 12;
+const size_t kLegacyTstampOffset = 16;
+const size_t kLegacyKeySizeOffset = 24;
+const size_t kLegacyValueSizeOffset = 32;
+
+inline size_t legacy_record_size(uint64_t key_size, uint64_t value_size)
+{
+    return kLegacyHeadSize + key_size + value_size + kValueTypeSize;
+}
+
+inline bool legacy_record_valid(const char *record, uint64_t key_size, uint64_t value_size)
+{
+    static const CRC::Table<crcpp_uint32, 32> table(CRC::CRC_32());
+    uint32_t crc, value_crc;
+    memcpy(&crc, record + kLegacyCrcOffset, kCRCSize);
+    memcpy(&value_crc, record + kLegacyValueCrcOffset, kCRCSize);
+
+    const char *value = record + kLegacyHeadSize + key_size;
+    uint32_t head_crc = crc32c(record + kLegacyValueCrcOffset, kLegacyHeadSize - kLegacyValueCrcOffset + key_size);
+    if (crc == crc32c_extend(head_crc, value + value_size, kValueTypeSize) && value_crc == crc32c(value, value_size))
+        return true;
+    return crc == CRC::Calculate(record + kLegacyTstampOffset,
+                                 legacy_record_size(key_size, value_size) - kLegacyTstampOffset, table);
+}
 
 struct Record : public InfoHeader
 {
     const std::string &key, &value;
     InfoType value_type;
 
+    // 编码好的头部，写入时和 key、value 的原始 string 拼成 iovec 一起写出
+    char head[kMaxRecordHeadSize];
+    size_t head_len = 0;
+
     Record(uint64_t tstamp, uint64_t key_size, uint64_t value_size, const std::string &key, const std::string &value, InfoType value_type)
-        : InfoHeader(tstamp, key_size, value_size), key(key), value(value), value_type(value_type)
+        : InfoHeader(tstamp, key_size, value_size), key(key), value(value), value_type(value_type) {}
+    ~Record() {}
+
+    size_t head_size() const { return record_head_size(key_size, value_size); }
+    size_t record_size() const { return ::record_size(key_size, value_size); }
+
+    // 只编码头部并算好 crc，key 和 value 不拷贝
+    size_t build_head()
     {
-        crc = CRC::Calculate(key.c_str(), key_size, CRC::CRC_32(), crc);
-        crc = CRC::Calculate(value.c_str(), value_size, CRC::CRC_32(), crc);
-        crc = CRC::Calculate(&value_type, kValueTypeSize, CRC::CRC_32(), crc);
+        head_len = encode_head(head, time_stamp, value_type, key_size, value_size, crc32c(value.data(), value_size));
+        crc = record_crc(head, head_len, key.data(), key_size);
+        memcpy(head + kRecCrcOffset, &crc, kCRCSize);
+        return head_len;
     }
-    ~Record() {}
 
+    // 整条 record 序列化到一块连续的内存里
     void build_buffer(char *temp)
     {
-        memcpy(temp, (void *)(InfoHeader *)this, kInfoHeadSize);
-        memcpy(temp + kInfoHeadSize, (void *)key.c_str(), key_size);
-        memcpy(temp + kInfoHeadSize + key_size, (void *)value.c_str(), value_size);
-        memcpy(temp + kInfoHeadSize + key_size + value_size, (void *)&value_type, kValueTypeSize);
+        build_head();
+        memcpy(temp, head, head_len);
+        memcpy(temp + head_len, key.data(), key_size);
+        memcpy(temp + head_len + key_size, value.data(), value_size);
     }
-};
\ No newline at end of file
+};
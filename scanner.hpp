@@ -0,0 +1,212 @@
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#include "record.hpp"
+
+const size_t kScanBlockSize = 1 << 20;
+const size_t kScanAlign = 4096;
+
+// 扫描出来的一条 record，key 和 value 指向 LogScanner 的缓冲区，下一次 next() 之后失效
+struct LogEntry
+{
+    const char *data; // 整条 record
+    uint64_t offset;  // record 在文件中的起始位置
+    size_t head_size;
+    size_t record_size;
+    bool legacy; // 老格式文件里的 record
+    uint32_t crc;
+    uint64_t tstamp;
+    std::string_view key, value;
+    InfoType type;
+
+    size_t size() const { return record_size; }
+    uint64_t value_offset() const { return offset + head_size + key.size(); }
+    bool valid() const
+    {
+        return legacy ? legacy_record_valid(data, key.size(), value.size())
+                      : record_valid(data, head_size, key.size(), value.size());
+    }
+};
+
+// 顺序读数据文件：每次 pread 一大块（起始位置按 4KB 对齐），在缓冲区里原地解析 record，
+// 一条 record 跨块时把剩下的部分挪到缓冲区开头再接着读。恢复、合并和离线工具共用。
+// 打开时根据文件头判断是新格式还是老格式。
+class LogScanner
+{
+private:
+    int fd;
+    uint64_t file_size;
+    uint64_t file_pos = 0; // 下一次 pread 的位置
+    uint64_t offset_ = 0;  // 下一条 record 的位置，也就是 buffer[begin] 对应的文件位置
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    size_t begin = 0, end = 0; // buffer 中还没解析的数据
+    bool broken = false;
+    bool legacy_ = true;
+
+    // 保证缓冲区里至少有 need 字节未解析的数据，文件里不够时返回 false
+    bool fill(size_t need)
+    {
+        if (end - begin >= need)
+            return true;
+        if (need > file_size - offset_)
+            return false;
+
+        memmove(buffer.get(), buffer.get() + begin, end - begin);
+        end -= begin;
+        begin = 0;
+
+        // 留出至少一个对齐块的空间，保证每次 pread 的长度是 4KB 的整数倍
+        if (need + kScanAlign > capacity)
+        {
+            size_t new_capacity = (need + kScanAlign * 2 - 1) / kScanAlign * kScanAlign;
+            std::unique_ptr<char[]> bigger(new char[new_capacity]);
+            memcpy(bigger.get(), buffer.get(), end);
+            buffer = std::move(bigger);
+            capacity = new_capacity;
+        }
+
+        while (end < need)
+        {
+            size_t room = (capacity - end) / kScanAlign * kScanAlign;
+            ssize_t read_nums = ::pread(fd, buffer.get() + end, room, file_pos);
+            if (read_nums < 0 && errno == EINTR)
+                continue;
+            if (read_nums <= 0)
+                return false;
+            end += read_nums;
+            file_pos += read_nums;
+        }
+        return true;
+    }
+
+public:
+    LogScanner(int fd, uint64_t file_size, size_t block_size = kScanBlockSize)
+        : fd(fd), file_size(file_size),
+          buffer(new char[block_size]), capacity(block_size)
+    {
+        posix_fadvise(fd, 0, file_size, POSIX_FADV_SEQUENTIAL);
+
+        uint32_t magic = 0;
+        if (fill(kFileHeaderSize))
+            memcpy(&magic, buffer.get(), 4);
+        if (magic == kFileMagic)
+        {
+            legacy_ = false;
+            begin += kFileHeaderSize;
+            offset_ += kFileHeaderSize;
+        }
+    }
+
+    ~LogScanner() { posix_fadvise(fd, 0, file_size, POSIX_FADV_NORMAL); }
+
+    LogScanner(const LogScanner &) = delete;
+    LogScanner &operator=(const LogScanner &) = delete;
+
+    // 读出下一条 record；到文件末尾，或者遇到不完整、长度不合理的 record 时返回 false
+    bool next(LogEntry *entry)
+    {
+        if (broken || offset_ == file_size)
+            return false;
+        return legacy_ ? next_legacy(entry) : next_record(entry);
+    }
+
+private:
+    bool fail()
+    {
+        broken = true;
+        return false;
+    }
+
+    bool next_record(LogEntry *entry)
+    {
+        uint64_t rest = file_size - offset_;
+        if (rest < kRecFixedSize || !fill(std::min<uint64_t>(kMaxRecordHeadSize, rest)))
+            return fail();
+
+        const char *p = buffer.get() + begin;
+        char type = p[kRecTypeOffset];
+        if ((uint8_t)p[0] != kRecordMagic || (type != kNewValue && type != kRemoveValue))
+            return fail();
+
+        uint64_t key_size, value_size;
+        const char *q = get_varint(p + kRecFixedSize, buffer.get() + end, &key_size);
+        if (q)
+            q = get_varint(q, buffer.get() + end, &value_size);
+        if (!q || key_size > kMaxKeySize || value_size > rest)
+            return fail();
+
+        size_t head_size = q - p;
+        if (head_size + key_size + value_size > rest || !fill(head_size + key_size + value_size))
+            return fail();
+
+        p = buffer.get() + begin;
+        entry->data = p;
+        entry->offset = offset_;
+        entry->head_size = head_size;
+        entry->record_size = head_size + key_size + value_size;
+        entry->legacy = false;
+        memcpy(&entry->crc, p + kRecCrcOffset, kCRCSize);
+        memcpy(&entry->tstamp, p + kRecTstampOffset, kTimeStampSize);
+        entry->key = std::string_view(p + head_size, key_size);
+        entry->value = std::string_view(p + head_size + key_size, value_size);
+        entry->type = (InfoType)type;
+        return advance(entry);
+    }
+
+    bool next_legacy(LogEntry *entry)
+    {
+        if (!fill(kLegacyHeadSize))
+            return fail();
+
+        uint64_t key_size, value_size;
+        memcpy(&key_size, buffer.get() + begin + kLegacyKeySizeOffset, 8);
+        memcpy(&value_size, buffer.get() + begin + kLegacyValueSizeOffset, 8);
+
+        uint64_t rest = file_size - offset_;
+        if (key_size > kMaxKeySize || value_size > rest ||
+            legacy_record_size(key_size, value_size) > rest ||
+            !fill(legacy_record_size(key_size, value_size)))
+            return fail();
+
+        const char *p = buffer.get() + begin;
+        char type = p[kLegacyHeadSize + key_size + value_size];
+        if (type != kNewValue && type != kRemoveValue)
+            return fail();
+
+        entry->data = p;
+        entry->offset = offset_;
+        entry->head_size = kLegacyHeadSize;
+        entry->record_size = legacy_record_size(key_size, value_size);
+        entry->legacy = true;
+        memcpy(&entry->crc, p + kLegacyCrcOffset, kCRCSize);
+        memcpy(&entry->tstamp, p + kLegacyTstampOffset, kTimeStampSize);
+        entry->key = std::string_view(p + kLegacyHeadSize, key_size);
+        entry->value = std::string_view(p + kLegacyHeadSize + key_size, value_size);
+        entry->type = (InfoType)type;
+        return advance(entry);
+    }
+
+    bool advance(LogEntry *entry)
+    {
+        begin += entry->size();
+        offset_ += entry->size();
+        return true;
+    }
+
+public:
+    // 已经解析过的字节数，扫描中途停下时就是完整 record 的总长度
+    uint64_t offset() const { return offset_; }
+    // 整个文件都解析完了，没有残缺的尾部
+    bool finished() const { return !broken && offset_ == file_size; }
+    // 没有文件头的老格式文件
+    bool legacy() const { return legacy_; }
+};
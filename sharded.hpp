@@ -0,0 +1,171 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "bitcask.hpp"
+#include "crc32c.hpp"
+
+// 把每个分区的有序迭代器归并成一个，每一步取当前 key 最小的分区
+class ShardedIterator
+{
+private:
+    std::vector<KeyIterator> parts_;
+    size_t current_ = 0;
+
+    void pick()
+    {
+        current_ = parts_.size();
+        for (size_t i = 0; i < parts_.size(); i++)
+        {
+            if (parts_[i].valid() && (current_ == parts_.size() || parts_[i].key() < parts_[current_].key()))
+                current_ = i;
+        }
+    }
+
+public:
+    ShardedIterator(std::vector<KeyIterator> parts) : parts_(std::move(parts)) { pick(); }
+
+    bool valid() const { return current_ < parts_.size(); }
+    void next()
+    {
+        parts_[current_].next();
+        pick();
+    }
+
+    const std::string &key() const { return parts_[current_].key(); }
+    const std::string &value() const { return parts_[current_].value(); }
+    const Status &status() const { return parts_[current_].status(); }
+};
+
+// 按 key 的 hash 把数据分到 N 个互相独立的 Bitcask 分区里，每个分区有自己的
+// 活跃 Log、索引和锁，写入只在同一分区内串行。分区 i 的数据放在 path/shard-i/。
+// 分区号是 crc32c(key) % N：key 落在哪个目录是磁盘格式的一部分，不能用随标准库实现变化的 std::hash
+class ShardedBitcask : public BasicOperation
+{
+private:
+    std::vector<std::unique_ptr<Bitcask>> shards_;
+
+    size_t shard_index(const std::string &key) const { return crc32c(key.data(), key.size()) % shards_.size(); }
+    Bitcask &shard_of(const std::string &key) { return *shards_[shard_index(key)]; }
+
+public:
+    ShardedBitcask(const Options &options = Options());
+
+    Status get(const std::string &key, std::string *str_get) { return shard_of(key).get(key, str_get); }
+    Status set(const std::string &key, const std::string &value) { return shard_of(key).set(key, value); }
+    Status remove(const std::string &key) { return shard_of(key).remove(key); }
+    // 按分区拆开，每个分区各自整组写入，读者看到的是每个分区的整组；分区之间不同时生效，崩溃后也可能只恢复出一部分
+    Status write(const WriteBatch &batch);
+    // 按分区拆开，每个分区各自在一个快照里读
+    std::vector<Status> multi_get(const std::vector<std::string> &keys, std::vector<std::string> *values);
+    // 每个分区各自取快照，再按 key 归并
+    ShardedIterator scan(const std::string &start, const std::string &end);
+    ShardedIterator prefix(const std::string &prefix);
+
+    size_t shard_count() const { return shards_.size(); }
+};
+
+ShardedBitcask::ShardedBitcask(const Options &options)
+{
+    size_t shards = options.shards ? options.shards : 1;
+
+    // 分区数决定了 key 落在哪个目录，已有数据时沿用磁盘上的分区数
+    size_t existing = 0;
+    if (fs::exists(options.path))
+    {
+        for (const auto &entry : fs::directory_iterator(options.path))
+        {
+            if (entry.is_directory() && entry.path().filename().string().rfind("shard-", 0) == 0)
+                existing++;
+        }
+    }
+    if (existing && existing != shards)
+    {
+        std::cout << "shard count " << shards << " mismatches " << existing
+                  << " shards on disk, using " << existing << std::endl;
+        shards = existing;
+    }
+
+    for (size_t i = 0; i < shards; i++)
+    {
+        Options shard_options = options;
+        shard_options.path = options.path + "shard-" + std::to_string(i) + "/";
+        shards_.emplace_back(new Bitcask(shard_options));
+    }
+}
+
+Status ShardedBitcask::write(const WriteBatch &batch)
+{
+    // 先整体检查，不让一部分分区写进去了另一部分被拒绝
+    for (auto &op : batch.ops())
+    {
+        if (op.key.size() > kMaxKeySize)
+            return Status(InvalidArgument, "key too long");
+    }
+    if (batch.bytes() > kMaxWriteSize)
+        return Status(InvalidArgument, "batch too large");
+
+    std::vector<WriteBatch> parts(shards_.size());
+    for (auto &op : batch.ops())
+    {
+        WriteBatch &part = parts[shard_index(op.key)];
+        if (op.type == kNewValue)
+            part.set(op.key, op.value);
+        else
+            part.remove(op.key);
+    }
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+        Status status = shards_[i]->write(parts[i]);
+        if (status.code != OK)
+            return status;
+    }
+    return Status(OK, "");
+}
+
+std::vector<Status> ShardedBitcask::multi_get(const std::vector<std::string> &keys, std::vector<std::string> *values)
+{
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    std::vector<std::vector<size_t>> slots(shards_.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        size_t shard = shard_index(keys[i]);
+        shard_keys[shard].push_back(keys[i]);
+        slots[shard].push_back(i);
+    }
+
+    std::vector<Status> statuses(keys.size(), Status(IoError, "key not found"));
+    values->assign(keys.size(), std::string());
+    for (size_t shard = 0; shard < shards_.size(); shard++)
+    {
+        if (shard_keys[shard].empty())
+            continue;
+        std::vector<std::string> shard_values;
+        std::vector<Status> shard_statuses = shards_[shard]->multi_get(shard_keys[shard], &shard_values);
+        for (size_t j = 0; j < slots[shard].size(); j++)
+        {
+            statuses[slots[shard][j]] = std::move(shard_statuses[j]);
+            (*values)[slots[shard][j]] = std::move(shard_values[j]);
+        }
+    }
+    return statuses;
+}
+
+ShardedIterator ShardedBitcask::scan(const std::string &start, const std::string &end)
+{
+    std::vector<KeyIterator> parts;
+    for (auto &shard : shards_)
+        parts.push_back(shard->scan(start, end));
+    return ShardedIterator(std::move(parts));
+}
+
+ShardedIterator ShardedBitcask::prefix(const std::string &prefix)
+{
+    std::vector<KeyIterator> parts;
+    for (auto &shard : shards_)
+        parts.push_back(shard->prefix(prefix));
+    return ShardedIterator(std::move(parts));
+}
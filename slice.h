@@ -0,0 +1,23 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// value 的只读视图。pin 持有视图背后的内存（mmap 映射或者一块堆内存），
+// Slice 存活期间这段字节一直有效。
+class Slice
+{
+private:
+    std::shared_ptr<const void> pin;
+    std::string_view view;
+
+public:
+    Slice() {}
+    Slice(std::shared_ptr<const void> pin, std::string_view view) : pin(std::move(pin)), view(view) {}
+
+    const char *data() const { return view.data(); }
+    size_t size() const { return view.size(); }
+    std::string_view string_view() const { return view; }
+    std::string to_string() const { return std::string(view); }
+};
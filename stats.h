@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+inline uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// 多线程累加的延迟统计：次数、总耗时和最大耗时
+struct LatencyStats
+{
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+
+    void add(uint64_t ns)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t cur = max_ns.load(std::memory_order_relaxed);
+        while (ns > cur && !max_ns.compare_exchange_weak(cur, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    double avg_us() const
+    {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        return n ? total_ns.load(std::memory_order_relaxed) / 1000.0 / n : 0;
+    }
+
+    double max_us() const { return max_ns.load(std::memory_order_relaxed) / 1000.0; }
+};
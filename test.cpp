@@ -1,4 +1,7 @@
 #include "bitcask.hpp"
+#include <atomic>
+#include <fstream>
+#include <map>
 #include <thread>
 #include <chrono>
 #include <vector>
@@ -31,6 +34,433 @@ void invoc2(Bitcask &test)
     }
 }
 
+int failures = 0;
+
+void check(bool ok, const string &what)
+{
+    if (!ok)
+    {
+        cout << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+bool has(Bitcask &db, const string &key, const string &value)
+{
+    string got;
+    return db.get(key, &got).code == OK && got == value;
+}
+
+bool missing(Bitcask &db, const string &key)
+{
+    string got;
+    return db.get(key, &got).code != OK;
+}
+
+// 按基线版本的布局追加一条 record：| vptr | crc | 空 | tstamp | key_size | value_size | key | value | type |，
+// crc 是 CRC_32，从 tstamp 算到 type
+void append_legacy(const string &file, uint64_t tstamp, const string &key, const string &value, InfoType type)
+{
+    string record(legacy_record_size(key.size(), value.size()), '\0');
+    uint64_t key_size = key.size(), value_size = value.size();
+    memcpy(&record[kLegacyTstampOffset], &tstamp, kTimeStampSize);
+    memcpy(&record[kLegacyKeySizeOffset], &key_size, kKeyLenSize);
+    memcpy(&record[kLegacyValueSizeOffset], &value_size, kValueLenSize);
+    memcpy(&record[kLegacyHeadSize], key.data(), key_size);
+    memcpy(&record[kLegacyHeadSize + key_size], value.data(), value_size);
+    memcpy(&record[kLegacyHeadSize + key_size + value_size], &type, kValueTypeSize);
+    uint32_t crc = CRC::Calculate(&record[kLegacyTstampOffset], record.size() - kLegacyTstampOffset, CRC::CRC_32());
+    memcpy(&record[kLegacyCrcOffset], &crc, kCRCSize);
+    ofstream(file, ios::binary | ios::app) << record;
+}
+
+// 老格式的 tstamp 不可信，新旧只看 (文件 id, 文件内位置)，合并重写以后也一样
+void test_legacy_upgrade()
+{
+    Options options;
+    options.path = "test_data/legacy/";
+    options.compact_threshold = 0;
+    options.compact_garbage_ratio = 0;
+    fs::remove_all(options.path);
+    fs::create_directories(options.path);
+    append_legacy(options.path + "0.log", 5, "k", "old", kNewValue);
+    append_legacy(options.path + "0.log", 9, "gone", "old", kNewValue);
+    append_legacy(options.path + "1.log", 0, "k", "new", kNewValue);
+    append_legacy(options.path + "1.log", 1, "gone", "", kRemoveValue);
+    append_legacy(options.path + "1.log", 0, "k2", "v2", kNewValue);
+    {
+        Bitcask db(options);
+        check(has(db, "k", "new"), "legacy: newest value by file order");
+        check(missing(db, "gone"), "legacy: later remove wins");
+        db.set("k2", "v3");
+        db.compact_round();
+        check(has(db, "k", "new") && has(db, "k2", "v3"), "legacy: values after compaction");
+    }
+    Bitcask db(options);
+    check(has(db, "k", "new"), "legacy: newest value after reopen");
+    check(missing(db, "gone"), "legacy: remove after reopen");
+    check(has(db, "k2", "v3"), "legacy: new write after reopen");
+}
+
+string read_file(const string &file)
+{
+    ifstream in(file, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// 目录里内容包含 needle 的数据文件
+string log_with(const string &dir, const string &needle)
+{
+    for (const auto &entry : fs::directory_iterator(dir))
+    {
+        if (entry.path().extension() == suffix && read_file(entry.path().string()).find(needle) != string::npos)
+            return entry.path().string();
+    }
+    return "";
+}
+
+// 把文件里 needle 的第一个字节改掉
+void corrupt(const string &file, const string &needle)
+{
+    size_t pos = read_file(file).find(needle);
+    fstream out(file, ios::binary | ios::in | ios::out);
+    out.seekp(pos);
+    out.put(needle[0] ^ 0x5a);
+}
+
+// 空目录，后台线程不合并，需要时测试自己调用 compact_round
+Options test_options(const string &path)
+{
+    Options options;
+    options.path = path;
+    options.sync_mode = kSyncNone;
+    options.compact_window_begin = options.compact_window_end = 0;
+    fs::remove_all(path);
+    return options;
+}
+
+Options durability_options(const string &path)
+{
+    Options options = test_options(path);
+    options.sync_mode = kSyncAlways;
+    options.max_log_size = 1 << 20;
+    {
+        Bitcask db(options);
+        for (int i = 0; i < 10; i++)
+            db.set("k" + to_string(i), "value" + to_string(i));
+    }
+    return options;
+}
+
+// 写到一半崩溃：最后一条 record 不完整，恢复时截掉它，前面的都在，之后还能接着写
+void test_torn_tail()
+{
+    Options options = durability_options("test_data/torn/");
+    string file = log_with(options.path, "value9");
+    fs::resize_file(file, fs::file_size(file) - 3);
+    {
+        Bitcask db(options);
+        for (int i = 0; i < 9; i++)
+            check(has(db, "k" + to_string(i), "value" + to_string(i)), "torn tail: k" + to_string(i) + " survives");
+        check(missing(db, "k9"), "torn tail: torn record dropped");
+        db.set("k9", "again");
+    }
+    Bitcask db(options);
+    check(has(db, "k9", "again"), "torn tail: write after truncation");
+}
+
+// 中间一条 record 的 crc 对不上：从它开始截掉，后面好的 record 也不要
+void test_checksum_truncation()
+{
+    Options options = durability_options("test_data/checksum/");
+    corrupt(log_with(options.path, "value5"), "value5");
+    Bitcask db(options);
+    for (int i = 0; i < 5; i++)
+        check(has(db, "k" + to_string(i), "value" + to_string(i)), "checksum: k" + to_string(i) + " survives");
+    for (int i = 5; i < 10; i++)
+        check(missing(db, "k" + to_string(i)), "checksum: k" + to_string(i) + " dropped");
+}
+
+// 有 hint 的文件恢复时不扫描，坏掉的 value 要靠 verify_reads 在读的时候发现
+void test_verify_reads()
+{
+    Options options = durability_options("test_data/verify/");
+    options.max_log_size = 1 << 8; // 每个文件只放得下几条 record，写满的文件切出去时写 hint
+    {
+        Bitcask db(options);
+        db.set("big", string(300, 'x'));
+    }
+    string file = log_with(options.path, "value0");
+    check(fs::exists(file.substr(0, file.size() - suffix.size()) + kHintSuffix), "verify reads: hint written");
+    corrupt(file, "value0");
+
+    options.verify_reads = true;
+    Bitcask db(options);
+    string value;
+    check(db.get("k0", &value).code == Corrupted, "verify reads: corrupted value reported");
+    check(has(db, "k9", "value9"), "verify reads: other values readable");
+}
+
+// 合并写完 MANIFEST、还没删旧文件时崩溃：恢复时先删掉 MANIFEST 里列出的文件，key 从剩下的文件里取
+void test_manifest_crash()
+{
+    Options options = durability_options("test_data/manifest/");
+    options.max_log_size = 1 << 8;
+    {
+        Bitcask db(options);
+        db.set("k0", string(300, 'n'));
+        db.set("k1", "after");
+    }
+    string file = log_with(options.path, string(300, 'n'));
+    uint32_t id = stoul(fs::path(file).stem().string());
+    check(file != log_with(options.path, "value0"), "manifest: overwrite in its own file");
+    manifest_write(options.path, {id});
+
+    Bitcask db(options);
+    check(!fs::exists(file), "manifest: listed file deleted");
+    check(!fs::exists(options.path + kManifestName), "manifest: removed after recovery");
+    check(has(db, "k0", "value0"), "manifest: key falls back to older file");
+    check(has(db, "k1", "after"), "manifest: other files kept");
+}
+
+// 遍历的同时另一个线程按 ops 的顺序覆盖写、删除、插入新 key（会让索引扩容重建），合并也在后台挪动 value。
+// 遍历结果必须正好是某一时刻的快照：ops 里生效的是一段前缀，没被碰过的 key 都是原来的 value
+void test_scan_snapshot()
+{
+    const int n = 30000;
+    auto key = [](int i)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "k%07d", i);
+        return string(buf);
+    };
+    for (size_t inline_size : {0, 8})
+    {
+        Options options = test_options("test_data/scan/");
+        options.max_log_size = 1 << 20;
+        options.compact_window_begin = 0;
+        options.compact_window_end = 24;
+        options.compact_threshold = 64 << 10;
+        options.compact_garbage_ratio = 0.2;
+        options.compact_interval_ms = 1;
+        options.inline_value_size = inline_size;
+        Bitcask db(options);
+        for (int i = 0; i < n; i++)
+            db.set(key(i), "v0-" + to_string(i));
+
+        vector<int> order(n);
+        for (int i = 0; i < n; i++)
+            order[i] = (int)((uint64_t)i * 7919 % n);
+        atomic<int> done{0};
+        thread writer([&]
+                      {
+                          for (int i = 0; i < n; i++)
+                          {
+                              if (i % 3 == 0)
+                                  db.remove(key(order[i]));
+                              else if (i % 3 == 1)
+                                  db.set(key(order[i]), "v1");
+                              else
+                                  db.set("n" + key(i), "new");
+                              done = i + 1;
+                          } });
+        while (done < n / 10)
+            this_thread::yield();
+        map<string, string> seen;
+        bool ok = true;
+        for (auto it = db.scan("", ""); it.valid(); it.next())
+        {
+            ok = ok && it.status().code == OK && !seen.count(it.key());
+            seen[it.key()] = it.value();
+        }
+        writer.join();
+
+        // 第 i 个操作是否反映在结果里
+        vector<bool> applied(n);
+        for (int i = 0; i < n; i++)
+        {
+            auto found = seen.find(i % 3 == 2 ? "n" + key(i) : key(order[i]));
+            if (i % 3 == 0)
+                applied[i] = found == seen.end();
+            else if (i % 3 == 1)
+            {
+                ok = ok && found != seen.end() && (found->second == "v1" || found->second == "v0-" + to_string(order[i]));
+                applied[i] = found != seen.end() && found->second == "v1";
+            }
+            else
+                applied[i] = found != seen.end();
+        }
+        int cut = 0;
+        while (cut < n && applied[cut])
+            cut++;
+        for (int i = cut; i < n; i++)
+            ok = ok && !applied[i];
+        ok = ok && seen.size() == (size_t)(n - (cut + 2) / 3 + cut / 3);
+        check(ok, "scan: snapshot is a prefix of the writes (inline " + to_string(inline_size) + ")");
+    }
+}
+
+// 删除记录所在的文件先被合并、旧 value 所在的文件还在时，删除记录必须留下来，否则重启后旧 value 又冒出来
+void test_tombstone_merge()
+{
+    Options options = test_options("test_data/tombstone/");
+    options.max_log_size = 1 << 10;
+    options.compact_threshold = 0;
+    options.compact_max_files = 1;
+    {
+        Bitcask db(options);
+        db.set("t", string(300, 't')); // 0.log：t 和一个有效的大 value
+        db.set("live", string(800, 'l'));
+        db.remove("t"); // 1.log：删除记录和一个马上被覆盖的 value
+        db.set("p", string(1000, 'p'));
+        db.set("p", "p2");
+        check(db.compact_round() == 1, "tombstone: only the newer file merged");
+        check(fs::exists(options.path + "0.log"), "tombstone: older file kept");
+    }
+    {
+        Bitcask db(options);
+        check(missing(db, "t"), "tombstone: remove survives merge and reopen");
+    }
+    options.compact_garbage_ratio = 0;
+    options.compact_max_files = 8;
+    {
+        Bitcask db(options);
+        db.compact_round();
+        check(missing(db, "t") && has(db, "live", string(800, 'l')) && has(db, "p", "p2"), "tombstone: full merge");
+    }
+    Bitcask db(options);
+    check(missing(db, "t") && has(db, "live", string(800, 'l')) && has(db, "p", "p2"), "tombstone: full merge and reopen");
+}
+
+// 合并掉的文件没人引用以后，合并线程要把它们删掉，不用等下一轮合并
+void test_merged_files_released()
+{
+    Options options = test_options("test_data/release/");
+    options.max_log_size = 1 << 10;
+    options.compact_threshold = 0;
+    options.compact_garbage_ratio = 0;
+    Bitcask db(options);
+    for (int i = 0; i < 20; i++)
+        db.set("k" + to_string(i % 4), string(300, 'a' + i % 26));
+    check(fs::exists(options.path + "0.log"), "release: first file written");
+    check(db.compact_round() > 0, "release: merged");
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(3);
+    while (fs::exists(options.path + "0.log") && chrono::steady_clock::now() < deadline)
+        this_thread::sleep_for(chrono::milliseconds(10));
+    check(!fs::exists(options.path + "0.log"), "release: merged file deleted");
+    for (int i = 16; i < 20; i++)
+        check(has(db, "k" + to_string(i % 4), string(300, 'a' + i % 26)), "release: k" + to_string(i % 4) + " readable");
+}
+
+// 同一组里同一个 key 出现多次时后面的生效，重启后也一样
+void test_write_batch()
+{
+    Options options = test_options("test_data/batch/");
+    {
+        Bitcask db(options);
+        db.set("c", "old");
+        WriteBatch batch;
+        batch.set("a", "1");
+        batch.remove("a");
+        batch.set("b", "1");
+        batch.set("b", "2");
+        batch.remove("c");
+        batch.set("d", "x");
+        batch.remove("d");
+        batch.set("d", "y");
+        check(db.write(batch).code == OK, "batch: written");
+        check(missing(db, "a") && has(db, "b", "2") && missing(db, "c") && has(db, "d", "y"), "batch: last op wins");
+    }
+    Bitcask db(options);
+    check(missing(db, "a") && has(db, "b", "2") && missing(db, "c") && has(db, "d", "y"), "batch: last op wins after reopen");
+}
+
+// 打乱顺序、带重复和不存在的 key：合并读出来的每个 value 都要回到自己的位置
+void test_multi_get()
+{
+    for (bool mmap_sealed : {true, false})
+    {
+        Options options = test_options("test_data/multi_get/");
+        options.max_log_size = 1 << 10;
+        options.mmap_sealed = mmap_sealed;
+        Bitcask db(options);
+        for (int i = 0; i < 20; i++)
+            db.set("m" + to_string(i), string(100 + i, 'a' + i));
+        db.remove("m7");
+
+        vector<string> keys = {"m19", "nope", "m3", "m18", "m7", "m3", "m0", "m17", "", "m1"};
+        vector<string> values;
+        vector<Status> statuses = db.multi_get(keys, &values);
+        bool ok = statuses.size() == keys.size() && values.size() == keys.size();
+        for (size_t i = 0; ok && i < keys.size(); i++)
+        {
+            bool found = keys[i].size() > 1 && keys[i][0] == 'm' && keys[i] != "m7";
+            int n = found ? stoi(keys[i].substr(1)) : 0;
+            ok = (statuses[i].code == OK) == found && (!found || values[i] == string(100 + n, 'a' + n));
+        }
+        check(ok, string("multi_get: slots match get (mmap_sealed ") + (mmap_sealed ? "on" : "off") + ")");
+    }
+}
+
+// value 缓存按位置缓存：覆盖写、合并挪走以后读到的必须是新 value，旧位置的条目要被清掉
+void test_cache_invalidation()
+{
+    Options options = test_options("test_data/cache/");
+    options.max_log_size = 1 << 10;
+    options.cache_bytes = 1 << 20;
+    options.cache_shards = 1;
+    options.compact_threshold = 0;
+    options.compact_garbage_ratio = 0;
+    Bitcask db(options);
+    db.set("c", "v1");
+    check(has(db, "c", "v1") && has(db, "c", "v1") && db.cache_stats().hits == 1, "cache: second get hits");
+    uint64_t entry = db.cache_stats().bytes;
+    db.set("c", "v2");
+    check(db.cache_stats().bytes == 0, "cache: overwritten value dropped");
+    check(has(db, "c", "v2") && db.cache_stats().bytes == entry, "cache: overwrite not served stale");
+
+    for (int i = 0; i < 10; i++)
+        db.set("pad", string(300, 'p'));
+    uint64_t misses = db.cache_stats().misses;
+    check(db.compact_round() > 0 && db.cache_stats().bytes == 0, "cache: merged value dropped");
+    check(has(db, "c", "v2") && db.cache_stats().misses == misses + 1, "cache: moved value read from new file");
+    check(has(db, "c", "v2") && db.cache_stats().hits == 2, "cache: moved value cached again");
+    db.remove("c");
+    check(missing(db, "c"), "cache: removed key not served");
+}
+
+// 内联的小 value 重启后从数据文件里重新装进索引，有 hint 的文件和活跃文件都一样
+void test_inline_reopen()
+{
+    Options options = test_options("test_data/inline/");
+    options.max_log_size = 1 << 10;
+    options.inline_value_size = 16;
+    auto verify = [&](Bitcask &db, const string &what)
+    {
+        bool ok = true;
+        for (int i = 0; i < 40; i++)
+            ok = ok && (i % 5 == 4 ? missing(db, "i" + to_string(i)) : has(db, "i" + to_string(i), string(i % 20, 'a' + i % 26)));
+        check(ok && has(db, "empty", "") && has(db, "big", string(200, 'b')), "inline: " + what);
+    };
+    {
+        Bitcask db(options);
+        db.set("empty", "");
+        for (int i = 0; i < 40; i++)
+            db.set("i" + to_string(i), string(i % 20, 'a' + i % 26));
+        db.set("big", string(200, 'b'));
+        for (int i = 4; i < 40; i += 5)
+            db.remove("i" + to_string(i));
+        verify(db, "before reopen");
+    }
+    {
+        Bitcask db(options);
+        verify(db, "after reopen");
+    }
+    options.inline_value_size = 0;
+    Bitcask db(options);
+    verify(db, "reopen without inlining");
+}
+
 int main()
 {
     Bitcask test;
@@ -63,9 +493,25 @@ int main()
     std::chrono::duration<double, std::milli> fp_ms = t2 - t1;
 
     std::cout << "time cost: " << fp_ms.count() << " ms" << endl;
+    std::cout << "commit avg: " << test.commit_stats().avg_us() << " us, "
+              << "flush avg: " << test.flush_stats().avg_us() << " us, "
+              << "flush max: " << test.flush_stats().max_us() << " us" << endl;
 
     std::cout << "====================================" << endl
               << "recovery data from log:" << endl;
 
-    return 0;
+    test_torn_tail();
+    test_checksum_truncation();
+    test_verify_reads();
+    test_manifest_crash();
+    test_legacy_upgrade();
+    test_scan_snapshot();
+    test_tombstone_merge();
+    test_merged_files_released();
+    test_write_batch();
+    test_multi_get();
+    test_cache_invalidation();
+    test_inline_reopen();
+    cout << (failures ? "tests failed: " + to_string(failures) : string("tests passed")) << endl;
+    return failures ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+// 不依赖 liburing，直接用 io_uring_setup / io_uring_enter 系统调用的最小封装。
+// 一个 IoUring 只能被一个线程使用；内核不支持时 ok() 返回 false，调用者走同步路径。
+class IoUring
+{
+private:
+    int ring_fd = -1;
+
+    void *sq_ptr = nullptr, *cq_ptr = nullptr;
+    size_t sq_len = 0, cq_len = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_len = 0;
+
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+    unsigned sq_entries = 0;
+
+    unsigned sqe_tail = 0; // 已经填好但还没提交给内核的位置
+    unsigned submitted = 0;
+
+public:
+    explicit IoUring(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd < 0)
+        {
+            std::cout << "io_uring_setup failed, fallback to sync io : " << strerror(errno) << std::endl;
+            return;
+        }
+
+        sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_len = cq_len = std::max(sq_len, cq_len);
+
+        sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cq_ptr = sq_ptr;
+        else
+            cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes_ptr = mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+        if (sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED)
+        {
+            std::cout << "io_uring mmap failed, fallback to sync io : " << strerror(errno) << std::endl;
+            if (sqes_ptr != MAP_FAILED)
+                munmap(sqes_ptr, sqes_len);
+            if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+                munmap(cq_ptr, cq_len);
+            if (sq_ptr != MAP_FAILED)
+                munmap(sq_ptr, sq_len);
+            sq_ptr = cq_ptr = nullptr;
+            close(ring_fd);
+            ring_fd = -1;
+            return;
+        }
+        sqes = (io_uring_sqe *)sqes_ptr;
+
+        char *sq = (char *)sq_ptr, *cq = (char *)cq_ptr;
+        sq_head = (unsigned *)(sq + params.sq_off.head);
+        sq_tail = (unsigned *)(sq + params.sq_off.tail);
+        sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+        sq_array = (unsigned *)(sq + params.sq_off.array);
+        cq_head = (unsigned *)(cq + params.cq_off.head);
+        cq_tail = (unsigned *)(cq + params.cq_off.tail);
+        cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        sq_entries = params.sq_entries;
+        sqe_tail = submitted = *sq_tail;
+    }
+
+    ~IoUring()
+    {
+        if (ring_fd < 0)
+            return;
+        munmap(sqes, sqes_len);
+        if (cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_len);
+        munmap(sq_ptr, sq_len);
+        close(ring_fd);
+    }
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    bool ok() const { return ring_fd >= 0; }
+    unsigned depth() const { return sq_entries; }
+
+    // 提交队列满了返回 nullptr
+    io_uring_sqe *get_sqe()
+    {
+        if (sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            return nullptr;
+        unsigned idx = sqe_tail & *sq_mask;
+        sq_array[idx] = idx;
+        sqe_tail++;
+
+        io_uring_sqe *sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    // 一次 io_uring_enter 提交所有填好的 sqe，并至少等到 wait_nr 个完成
+    int submit(unsigned wait_nr = 0)
+    {
+        __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+        unsigned to_submit = sqe_tail - submitted;
+        submitted = sqe_tail;
+
+        while (true)
+        {
+            int ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr,
+                              wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret >= 0 || errno != EINTR)
+                return ret;
+        }
+    }
+
+    io_uring_cqe *peek()
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            return nullptr;
+        return &cqes[head & *cq_mask];
+    }
+
+    void seen() { __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE); }
+
+    static void prep_rw(io_uring_sqe *sqe, int op, int fd, const void *addr, unsigned len, uint64_t offset, uint64_t user_data)
+    {
+        sqe->opcode = op;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)addr;
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+    }
+};
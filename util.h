@@ -1,9 +1,57 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
 
 int get_log_id(const std::string &fname)
 {
     std::string id_str = fname.substr(0, fname.size() - 4);
     return stoi(id_str);
-}
\ No newline at end of file
+}
+
+// 用 threads 个线程执行 fn(0) .. fn(n - 1)，各线程按原子计数领取下一个下标
+template <typename Fn>
+void parallel_for(size_t n, size_t threads, Fn &&fn)
+{
+    threads = std::max<size_t>(1, std::min(threads, n));
+    std::atomic<size_t> next{0};
+    auto work = [&]
+    {
+        for (size_t i = next++; i < n; i = next++)
+            fn(i);
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads; t++)
+        workers.emplace_back(work);
+    work();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+// 按平均速率限速：从创建起累计的字节数不超过 rate * 经过的时间，rate 为 0 表示不限速
+class RateLimiter
+{
+private:
+    std::chrono::steady_clock::time_point start;
+    uint64_t rate;
+    uint64_t bytes = 0;
+
+public:
+    explicit RateLimiter(uint64_t rate) : start(std::chrono::steady_clock::now()), rate(rate) {}
+
+    // 记下 n 字节的 I/O，返回还要等多久才能接着做
+    std::chrono::nanoseconds request(uint64_t n)
+    {
+        bytes += n;
+        if (!rate)
+            return std::chrono::nanoseconds(0);
+        auto due = start + std::chrono::nanoseconds((uint64_t)(bytes * 1e9 / rate));
+        auto now = std::chrono::steady_clock::now();
+        return due > now ? std::chrono::duration_cast<std::chrono::nanoseconds>(due - now) : std::chrono::nanoseconds(0);
+    }
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "record.hpp"
+
+// 攒在一起写入的一组 set/remove。Bitcask::write 把整组 record 作为一个单元交给组提交：
+// 在文件里连续追加、一次刷盘，索引在同一次加锁里按顺序更新，读者要么看到整组、要么都看不到。
+// 崩溃不是整组的：record 各自带 crc，恢复时保留不完整 record 之前的所有 record，
+// 写到一半崩溃的一组可能只恢复出前面一部分。同一个 key 出现多次时后面的生效
+class WriteBatch
+{
+public:
+    struct Op
+    {
+        InfoType type;
+        std::string key, value;
+    };
+
+private:
+    std::vector<Op> ops_;
+    size_t bytes_ = 0;
+
+public:
+    void set(const std::string &key, const std::string &value)
+    {
+        ops_.push_back(Op{kNewValue, key, value});
+        bytes_ += record_size(key.size(), value.size());
+    }
+
+    void remove(const std::string &key)
+    {
+        ops_.push_back(Op{kRemoveValue, key, std::string()});
+        bytes_ += record_size(key.size(), 0);
+    }
+
+    void clear()
+    {
+        ops_.clear();
+        bytes_ = 0;
+    }
+
+    const std::vector<Op> &ops() const { return ops_; }
+    size_t count() const { return ops_.size(); }
+    bool empty() const { return ops_.empty(); }
+    // 写进数据文件后占的字节数
+    size_t bytes() const { return bytes_; }
+};